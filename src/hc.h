@@ -0,0 +1,34 @@
+#ifndef HC_H
+#define HC_H
+
+#include <stddef.h> // for size_t
+
+// Library API, see make lib. Context holds caches shared by all sites using
+// the same theme. Everything is safe to use from any thread, pages of the same
+// site can be rendered concurrently.
+
+struct hc;
+struct hc_site;
+struct hc_page;
+
+// theme dir is used as is, templates are loaded on first use,
+// empty dir means theme embedded with make THEME=path
+struct hc *hc_alloc(char *tpl_path);
+void hc_free(struct hc *hc);
+
+// load the whole theme dir in parallel
+void hc_preload(struct hc *hc);
+
+// read site structure and configurations, page content is read on render
+struct hc_site *hc_site_alloc(struct hc *hc, char *in_path, char *root_url);
+void hc_site_free(struct hc_site *site);
+
+// path is relative to output dir, like "/blog/2024-04-20.html" or "/blog/"
+struct hc_page *hc_page_find(struct hc_site *site, char *path);
+
+// render page into buffer, which is always null-terminated if size > 0,
+// returns page length like snprintf does, -1 if page can't be rendered
+long hc_page_render(struct hc_site *site, struct hc_page *page, char *buf,
+                    size_t size);
+
+#endif
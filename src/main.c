@@ -1,16 +1,42 @@
 #define _DEFAULT_SOURCE
 
-#include <assert.h>    // for assert
-#include <dirent.h>    // for closedir, opendir, readdir, dirent, DIR, DT_DIR
-#include <errno.h>     // for errno, EEXIST
-#include <stdbool.h>   // for true, bool, false
-#include <stddef.h>    // for size_t, ptrdiff_t
-#include <stdio.h>     // for NULL, fprintf, stderr, size_t, fclose
-#include <stdlib.h>    // for free, EXIT_FAILURE, EXIT_SUCCESS
-#include <string.h>    // for strerror, strcmp, strlen, strchr
-#include <sys/stat.h>  // for mkdir
-#include <sys/types.h> // for S_IRWXU, SEEK_END, SEEK_SET
-#include <unistd.h>    // for optarg, getopt
+#include <assert.h>      // for assert
+#include <ctype.h>       // for isalnum, isdigit, ispunct, tolower
+#include <dirent.h>      // for closedir, opendir, readdir, DIR, DT_DIR
+#include <errno.h>       // for errno, EEXIST
+#include <fcntl.h>       // for open, O_RDONLY
+#include <getopt.h>      // for getopt_long, option, required_argument
+#include <netdb.h>       // for getaddrinfo, freeaddrinfo, gai_strerror
+#include <inttypes.h>    // for PRIu32, PRIx64, SCNx64
+#include <pthread.h>     // for pthread_create, pthread_join, pthread_mutex_t
+#include <signal.h>      // for signal, SIGPIPE, SIG_IGN
+#include <stdbool.h>     // for true, bool, false
+#include <stddef.h>      // for size_t, ptrdiff_t
+#include <stdint.h>      // for uint32_t, int64_t, uint64_t, uintptr_t
+#include <stdio.h>       // for NULL, fprintf, stderr, open_memstream
+#include <stdlib.h>      // for free, EXIT_FAILURE, EXIT_SUCCESS
+#include <string.h>      // for strerror, strcmp, strlen, strchr
+#include <strings.h>     // for strncasecmp
+#include <sys/mman.h>    // for mmap, munmap, MAP_FAILED, MAP_PRIVATE
+#include <sys/socket.h>  // for accept, bind, listen, setsockopt, socket
+#include <sys/stat.h>    // for mkdir, stat, mkdirat
+#include <sys/syscall.h> // for SYS_renameat2, SYS_syncfs, SYS_gettid
+#include <sys/time.h>    // for timeval
+#include <sys/types.h>   // for S_IRWXU, SEEK_END, SEEK_SET
+#include <time.h>        // for time, time_t, clock_gettime
+#include <unistd.h>      // for optarg, getopt, sysconf, unlinkat, syscall
+
+#include "hc.h"
+
+#ifdef HC_ZLIB
+#include <zlib.h> // for deflate, deflateInit2, deflateBound, z_stream
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h> // for _mm_cmpeq_epi8, _mm_movemask_epi8
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h> // for vceqq_u8, vmaxvq_u8
+#endif
 
 #define VERSION 1.1.2
 
@@ -28,6 +54,16 @@
 #define NAME_MAX 255
 #endif
 
+#ifdef __APPLE__
+#define ST_MTIM st_mtimespec
+#else
+#define ST_MTIM st_mtim
+#endif
+
+#if defined(__linux__) && !defined(RENAME_EXCHANGE)
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
 /// Memory
 
 static void *realloc_safe(void *ptr, size_t size) {
@@ -66,6 +102,108 @@ static void buf_realloc(struct buf *buf, size_t len) {
 
 static void buf_free(struct buf buf) { free(buf.buf); }
 
+static void buf_append(struct buf *buf, char *mem, size_t len) {
+    assert(buf != NULL);
+    assert(mem != NULL);
+
+    if (len == 0) {
+        return;
+    }
+
+    size_t offset = buf->len;
+    buf_realloc(buf, offset + len);
+    memcpy(buf->buf + offset, mem, len);
+    buf->buf[offset + len] = '\0';
+}
+
+// grow array twice each time count reaches power of two
+static void *array_grow(void *arr, size_t count, size_t size) {
+    assert(size > 0);
+
+    if ((count & (count - 1)) != 0) {
+        return arr;
+    }
+
+    return realloc_safe(arr, (count > 0 ? count * 2 : 1) * size);
+}
+
+#define SCRATCH_BUF_KEEP (4 * 1024 * 1024) // larger buffers aren't reused
+
+// Scratch buffers are reused by every render on the same thread, so steady
+// state rendering doesn't allocate. Buffers are taken like a stack, string
+// lives until its buffer is released or scratch is reset.
+struct scratch {
+    struct buf **bufs; // pointers stay valid while the array grows
+    size_t buf_count;
+    size_t used;
+};
+
+// returns empty buffer
+static struct buf *scratch_buf(struct scratch *scratch) {
+    assert(scratch != NULL);
+
+    if (scratch->used == scratch->buf_count) {
+        scratch->bufs = array_grow(scratch->bufs, scratch->buf_count,
+                                   sizeof(*scratch->bufs));
+        scratch->bufs[scratch->buf_count] = calloc(1, sizeof(struct buf));
+        ++scratch->buf_count;
+    }
+
+    struct buf *buf = scratch->bufs[scratch->used];
+    ++scratch->used;
+
+    if (buf->buf == NULL) {
+        buf_realloc(buf, 1);
+    }
+
+    buf->len = 0;
+    *buf->buf = '\0';
+    return buf;
+}
+
+static size_t scratch_mark(struct scratch *scratch) {
+    assert(scratch != NULL);
+
+    return scratch->used;
+}
+
+// buffers taken after mark can be reused
+static void scratch_release(struct scratch *scratch, size_t mark) {
+    assert(scratch != NULL);
+    assert(mark <= scratch->used);
+
+    scratch->used = mark;
+}
+
+static void scratch_reset(struct scratch *scratch) {
+    assert(scratch != NULL);
+
+    // single huge page shouldn't hold memory forever
+    for (size_t i = 0; i < scratch->used; ++i) {
+        struct buf *buf = scratch->bufs[i];
+        if (buf->cap > SCRATCH_BUF_KEEP) {
+            buf_free(*buf);
+            *buf = (struct buf){0};
+        }
+    }
+
+    scratch->used = 0;
+}
+
+static void scratch_free(struct scratch *scratch) {
+    if (scratch == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < scratch->buf_count; ++i) {
+        buf_free(*scratch->bufs[i]);
+        free(scratch->bufs[i]);
+    }
+
+    free(scratch->bufs);
+    *scratch = (struct scratch){0};
+}
+
 /// Strings
 
 static void strcpy_safe(char *dst, char *src, size_t size) {
@@ -124,23 +262,84 @@ static void strsub(char *dst, char *src, char *find, char *rep) {
     strcpy(dst, src);
 }
 
+#define STRSUB_FIND_MAX 128
+#define STRSUB_PH_OPEN "{{ "
+#define STRSUB_PH_OPEN_LEN (sizeof(STRSUB_PH_OPEN) - 1)
+#define STRSUB_PH_CLOSE " }}"
+#define STRSUB_PH_CLOSE_LEN (sizeof(STRSUB_PH_CLOSE) - 1)
+
+// placeholders like "{{ key }}" are also substituted with escaped values
+// when written as "{{ key | escape }}"
 struct strsub_pair {
     char *find;
     char *rep;
 };
 
-static char *strsub_alloc(char *src, struct strsub_pair *pairs,
-                          size_t pair_count) {
+// buffer holds the string and space for substitution result after it
+static void strsub_buf(struct buf *buf, size_t *len, char *find, char *rep) {
+    assert(buf != NULL);
+    assert(len != NULL);
+    assert(find != NULL);
+    assert(rep != NULL);
+
+    size_t find_len = strlen(find);
+    size_t rep_len = strlen(rep);
+
+    // calculate result buffer size
+    size_t new_len = *len;
+    char *match = buf->buf;
+    while ((match = strstr(match, find)) != NULL) {
+        new_len += rep_len - find_len;
+        match += find_len;
+    }
+
+    // realloc if need more memory
+    buf_realloc(buf, *len + new_len + 1); // additional null-terminator
+
+    // substitute into second half of the buffer
+    strsub(buf->buf + *len + 1, buf->buf, find, rep);
+    // copy second half of the buffer to the first one
+    memmove(buf->buf, buf->buf + *len + 1, new_len);
+    buf->buf[new_len] = '\0'; // ensure C-string
+    *len = new_len;
+}
+
+// make "{{ key | filter }}" from "{{ key }}"
+static bool strsub_filter_find(char *dst, size_t size, char *find,
+                               char *filter) {
+    assert(dst != NULL);
+    assert(find != NULL);
+    assert(filter != NULL);
+
+    size_t len = strlen(find);
+    if (len <= STRSUB_PH_OPEN_LEN + STRSUB_PH_CLOSE_LEN ||
+        strncmp(find, STRSUB_PH_OPEN, STRSUB_PH_OPEN_LEN) != 0 ||
+        strcmp(find + len - STRSUB_PH_CLOSE_LEN, STRSUB_PH_CLOSE) != 0) {
+
+        return false;
+    }
+
+    int key_end = (int)(len - STRSUB_PH_CLOSE_LEN);
+    snprintf(dst, size, "%.*s | %s" STRSUB_PH_CLOSE, key_end, find, filter);
+    return true;
+}
+
+static void html_escape_buf(struct buf *buf, char *str);
+
+// result lives in scratch
+static char *strsub_scratch(struct scratch *scratch, char *src,
+                            struct strsub_pair *pairs, size_t pair_count) {
 
+    assert(scratch != NULL);
     assert(src != NULL);
     assert(pairs != NULL);
 
     // initial fat buffer
     size_t src_len = strlen(src);
-    struct buf buf = {0};
+    struct buf *buf = scratch_buf(scratch);
     // +1, since we need two null-terminators (first one handled internally)
-    buf_realloc(&buf, src_len + 1);
-    strcpy(buf.buf, src);
+    buf_realloc(buf, src_len + 1);
+    strcpy(buf->buf, src);
 
     for (size_t i = 0; i < pair_count; ++i) {
         struct strsub_pair *pair = &pairs[i];
@@ -149,881 +348,6977 @@ static char *strsub_alloc(char *src, struct strsub_pair *pairs,
 
         // treat NULL as empty string
         char *rep = pair->rep != NULL ? pair->rep : "";
+        strsub_buf(buf, &src_len, pair->find, rep);
+
+        // same placeholder with escape filter
+        char find[STRSUB_FIND_MAX];
+        if (strsub_filter_find(find, sizeof(find), pair->find, "escape") &&
+            strstr(buf->buf, find) != NULL) {
+
+            size_t mark = scratch_mark(scratch);
+            struct buf *escaped = scratch_buf(scratch);
+            html_escape_buf(escaped, rep);
+            strsub_buf(buf, &src_len, find, escaped->buf);
+            scratch_release(scratch, mark);
+        }
+    }
 
-        size_t find_len = strlen(pair->find);
-        size_t rep_len = strlen(rep);
+    return buf->buf;
+}
 
-        // calculate result buffer size
-        size_t new_len = src_len;
-        char *match = buf.buf;
-        while ((match = strstr(match, pair->find)) != NULL) {
-            new_len += rep_len - find_len;
-            match += find_len;
-        }
+/// HTML
+
+static char *html_escape_entity(char c) {
+    switch (c) {
+    case '&':
+        return "&amp;";
+    case '<':
+        return "&lt;";
+    case '>':
+        return "&gt;";
+    case '"':
+        return "&quot;";
+    case '\'':
+        return "&#39;";
+    default:
+        return NULL;
+    }
+}
+
+// length of the prefix without characters to escape,
+// checks 16 bytes at once where possible
+static size_t html_escape_span(char *str, size_t len) {
+    assert(str != NULL);
 
-        // realloc if need more memory
-        buf_realloc(&buf, src_len + new_len + 1); // additional null-terminator
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    __m128i amp = _mm_set1_epi8('&');
+    __m128i lt = _mm_set1_epi8('<');
+    __m128i gt = _mm_set1_epi8('>');
+    __m128i quot = _mm_set1_epi8('"');
+    __m128i apos = _mm_set1_epi8('\'');
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((__m128i *)(str + i));
+        __m128i match = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, lt)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, gt),
+                         _mm_or_si128(_mm_cmpeq_epi8(chunk, quot),
+                                      _mm_cmpeq_epi8(chunk, apos))));
+
+        // exact position is found below
+        if (_mm_movemask_epi8(match) != 0) {
+            break;
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint8x16_t amp = vdupq_n_u8('&');
+    uint8x16_t lt = vdupq_n_u8('<');
+    uint8x16_t gt = vdupq_n_u8('>');
+    uint8x16_t quot = vdupq_n_u8('"');
+    uint8x16_t apos = vdupq_n_u8('\'');
+
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t chunk = vld1q_u8((uint8_t *)(str + i));
+        uint8x16_t match = vorrq_u8(
+            vorrq_u8(vceqq_u8(chunk, amp), vceqq_u8(chunk, lt)),
+            vorrq_u8(vceqq_u8(chunk, gt),
+                     vorrq_u8(vceqq_u8(chunk, quot), vceqq_u8(chunk, apos))));
+
+        // exact position is found below
+        if (vmaxvq_u8(match) != 0) {
+            break;
+        }
+    }
+#endif
 
-        // substitute into second half of the buffer
-        strsub(buf.buf + src_len + 1, buf.buf, pair->find, rep);
-        // copy second half of the buffer to the first one
-        memmove(buf.buf, buf.buf + src_len + 1, new_len);
-        buf.buf[new_len] = '\0'; // ensure C-string
-        src_len = new_len;
+    for (; i < len; ++i) {
+        if (html_escape_entity(str[i]) != NULL) {
+            break;
+        }
     }
 
-    return buf.buf;
+    return i;
 }
 
-/// FS
+// buffer is replaced with escaped string
+static void html_escape_buf(struct buf *buf, char *str) {
+    assert(buf != NULL);
+    assert(str != NULL);
 
-static char *file_alloc(char *path) {
-    assert(path != NULL);
+    size_t len = strlen(str);
 
-    FILE *file = fopen(path, "rb");
-    if (file == NULL) {
-        PERROR("can't open file: %s", path);
-        return NULL;
-    }
+    // calculate result size, usually there is nothing to escape
+    size_t new_len = len;
+    for (size_t i = html_escape_span(str, len); i < len;
+         i += html_escape_span(str + i, len - i)) {
 
-    if (fseek(file, 0, SEEK_END) != 0) {
-        PERROR("fseek failed: %s", path);
-        goto close;
+        new_len += strlen(html_escape_entity(str[i])) - 1;
+        ++i;
     }
 
-    // todo: better to read by chunks and realloc
-    long buf_size = ftell(file);
-    if (buf_size == -1) {
-        PERROR("ftell failed: %s", path);
-        goto close;
+    buf_realloc(buf, new_len + 1); // never empty, so always allocated
+    buf->len = new_len;
+    if (new_len == len) {
+        memcpy(buf->buf, str, len + 1);
+        return;
     }
 
-    if (fseek(file, 0, SEEK_SET) != 0) {
-        PERROR("fseek failed: %s", path);
-        goto close;
+    char *dst = buf->buf;
+    for (size_t i = 0; i < len;) {
+        size_t span = html_escape_span(str + i, len - i);
+        memcpy(dst, str + i, span);
+        dst += span;
+        i += span;
+
+        if (i < len) {
+            char *entity = html_escape_entity(str[i]);
+            size_t entity_len = strlen(entity);
+            memcpy(dst, entity, entity_len);
+            dst += entity_len;
+            ++i;
+        }
     }
 
-    char *buf = malloc(buf_size + 1);
-    buf[buf_size] = '\0';
+    *dst = '\0';
+}
 
-    if (buf_size > 0 && fread(buf, buf_size, 1, file) != 1) {
-        PERROR("fread failed: %s", path);
-        goto free;
-    }
+/// Markdown
+
+// Common subset rendered in a single pass over lines: headings, paragraphs,
+// lists, quotes, fenced code, rules, emphasis, code spans, links and images.
+// Lines starting with a tag are passed as is, placeholders are kept intact.
+// Inline tags and entities are kept, other "&" and "<" are escaped.
+
+#define MD_CODE_FENCE "```"
+#define MD_CODE_FENCE_LEN (sizeof(MD_CODE_FENCE) - 1)
+#define MD_HEADING_MAX 6
+#define MD_INLINE_SPECIAL "{\\`*_![&<" // characters that can start a span
+
+enum md_block {
+    MD_NONE,
+    MD_PARA,
+    MD_UL,
+    MD_OL,
+    MD_QUOTE,
+    MD_CODE,
+    MD_HTML,
+};
 
-    if (fclose(file) == EOF) {
-        PERROR("fclose failed: %s", path);
-        goto free;
+static void md_put_str(struct buf *out, char *str) {
+    buf_append(out, str, strlen(str));
+}
+
+static void md_put_escaped(struct buf *out, char *mem, size_t len) {
+    assert(mem != NULL);
+
+    while (len > 0) {
+        size_t span = html_escape_span(mem, len);
+        buf_append(out, mem, span);
+        if (span == len) {
+            break;
+        }
+
+        md_put_str(out, html_escape_entity(mem[span]));
+        mem += span + 1;
+        len -= span + 1;
     }
+}
 
-    return buf;
+static char *md_find(char *mem, size_t len, char *delim) {
+    assert(mem != NULL);
+    assert(delim != NULL);
 
-    // cleanup
-free:
-    free(buf);
+    size_t delim_len = strlen(delim);
+    for (size_t i = 0; i + delim_len <= len; ++i) {
+        if (memcmp(mem + i, delim, delim_len) == 0) {
+            return mem + i;
+        }
+    }
 
-close:
-    fclose(file);
     return NULL;
 }
 
-static void file_write(char *path, char *str) {
-    assert(path != NULL);
-    assert(str != NULL);
+// find closing delimiter, which must follow non-space character
+static char *md_closing(char *mem, size_t len, char *delim) {
+    assert(mem != NULL);
+    assert(delim != NULL);
 
-    FILE *file = fopen(path, "wb");
-    if (file == NULL) {
-        PERROR("can't open file: %s", path);
-        return;
+    size_t delim_len = strlen(delim);
+    if (len <= delim_len || mem[0] == ' ') {
+        return NULL;
     }
 
-    if (fputs(str, file) == EOF) {
-        PERROR("fputs failed: %s", path);
-        goto close;
+    for (size_t i = 1; i + delim_len <= len; ++i) {
+        if (memcmp(mem + i, delim, delim_len) == 0 && mem[i - 1] != ' ') {
+            return mem + i;
+        }
     }
 
-    // cleanup
-close:
-    fclose(file);
+    return NULL;
 }
 
-static void mkdir_p(char *path) {
-    assert(path != NULL);
+// "&amp;", "&#39;" or "&#x27;"
+static bool md_entity(char *mem, size_t len) {
+    assert(mem != NULL);
 
-    char buf[PATH_MAX];
-    strcpy_safe(buf, path, sizeof(buf));
+    size_t i = 1;
+    if (i < len && mem[i] == '#') {
+        ++i;
+    }
 
-    char *match = buf;
-    while ((match = strchr(match, '/')) != NULL) {
-        *match = '\0'; // treat slash as end of the string
+    size_t start = i;
+    while (i < len && isalnum((unsigned char)mem[i])) {
+        ++i;
+    }
 
-        if (mkdir(buf, S_IRWXU) == -1 && errno != EEXIST) {
-            PERROR("can't create dir: %s", buf);
-            return;
-        }
+    return i > start && i < len && mem[i] == ';';
+}
 
-        *match = '/'; // then return it for nested directory
-        ++match;
-    }
+// "<a", "</a" or "<!--"
+static bool md_tag(char *mem, size_t len) {
+    assert(mem != NULL);
+
+    return len > 1 && (isalpha((unsigned char)mem[1]) || mem[1] == '/' ||
+                       mem[1] == '!');
 }
 
-/// Configuration
+static void md_inline(struct buf *out, char *mem, size_t len);
 
-#define CONF_MAX 256
-#define CONF_FM_DELIM "---\n"
-#define CONF_FM_DELIM_LEN (sizeof(CONF_FM_DELIM) - 1)
-#define CONF_KV_DELIM " = "
-#define CONF_KV_DELIM_LEN (sizeof(CONF_KV_DELIM) - 1)
-#define CONF_NULL_PH '\177' // DEL control character (ASCII 127)
+static void md_inline_tag(struct buf *out, char *tag, char *mem, size_t len) {
+    md_put_str(out, "<");
+    md_put_str(out, tag);
+    md_put_str(out, ">");
+    md_inline(out, mem, len);
+    md_put_str(out, "</");
+    md_put_str(out, tag);
+    md_put_str(out, ">");
+}
 
-struct conf_pair {
-    char *key;
-    char *val;
-};
+// [text](url) or ![alt](src), returns consumed length or zero
+static size_t md_inline_link(struct buf *out, char *mem, size_t len) {
+    assert(mem != NULL);
 
-struct conf {
-    struct conf_pair pairs[CONF_MAX];
-    size_t pair_count;
-    char *content;
-    char *buf;
-};
+    bool is_image = mem[0] == '!';
+    size_t text = is_image ? 2 : 1;
+    if (len <= text || mem[text - 1] != '[') {
+        return 0;
+    }
 
-static void conf_read(struct conf *conf, char *str) {
-    assert(conf != NULL);
-    assert(str != NULL);
+    char *text_end = memchr(mem + text, ']', len - text);
+    if (text_end == NULL || text_end + 1 >= mem + len || text_end[1] != '(') {
+        return 0;
+    }
 
-    conf->pair_count = 0;
-    conf->content = NULL;
-    conf->buf = str;
+    char *url = text_end + 2;
+    char *url_end = memchr(url, ')', mem + len - url);
+    if (url_end == NULL) {
+        return 0;
+    }
 
-    // no front matter, assume everything is a content
-    if (strncmp(conf->buf, CONF_FM_DELIM, CONF_FM_DELIM_LEN) != 0) {
-        conf->content = conf->buf;
-        return;
+    if (is_image) {
+        md_put_str(out, "<img src=\"");
+        md_put_escaped(out, url, url_end - url);
+        md_put_str(out, "\" alt=\"");
+        md_put_escaped(out, mem + text, text_end - mem - text);
+        md_put_str(out, "\">");
+    } else {
+        md_put_str(out, "<a href=\"");
+        md_put_escaped(out, url, url_end - url);
+        md_put_str(out, "\">");
+        md_inline(out, mem + text, text_end - mem - text);
+        md_put_str(out, "</a>");
     }
 
-    // read line by line
-    char *match = conf->buf;
-    while ((match = strchr(match, '\n')) != NULL) {
-        *match = CONF_NULL_PH; // replace NL with null-terminator
-        ++match;
+    return url_end + 1 - mem;
+}
 
-        // end of key-value pairs, everything else is a content
-        if (strncmp(match, CONF_FM_DELIM, CONF_FM_DELIM_LEN) == 0) {
-            conf->content = match + CONF_FM_DELIM_LEN;
+static void md_inline(struct buf *out, char *mem, size_t len) {
+    assert(out != NULL);
+    assert(mem != NULL);
+
+    size_t plain = 0; // start of plain text not written yet
+    size_t i = 0;
+    while (i < len) {
+        char *rest = mem + i;
+        size_t rest_len = len - i;
+        size_t used = 0;
+
+        if (*rest == '\0' || strchr(MD_INLINE_SPECIAL, *rest) == NULL) {
+            ++i;
+            continue;
+        }
+
+        // span may start here, flush plain text before it
+        buf_append(out, mem + plain, i - plain);
+        plain = i;
+
+        switch (*rest) {
+        case '{': {
+            // placeholders are substituted later, keep them as is
+            char *end = md_find(rest, rest_len, "}}");
+            if (rest_len > 1 && rest[1] == '{' && end != NULL) {
+                buf_append(out, rest, end + 2 - rest);
+                used = end + 2 - rest;
+            }
             break;
         }
+        case '\\':
+            if (rest_len > 1 && ispunct((unsigned char)rest[1])) {
+                md_put_escaped(out, rest + 1, 1);
+                used = 2;
+            }
+            break;
+        case '&':
+            if (!md_entity(rest, rest_len)) {
+                md_put_str(out, "&amp;");
+                used = 1;
+            }
+            break;
+        case '<':
+            if (!md_tag(rest, rest_len)) {
+                md_put_str(out, "&lt;");
+                used = 1;
+            }
+            break;
+        case '`': {
+            char *end = memchr(rest + 1, '`', rest_len - 1);
+            if (end != NULL) {
+                md_put_str(out, "<code>");
+                md_put_escaped(out, rest + 1, end - rest - 1);
+                md_put_str(out, "</code>");
+                used = end + 1 - rest;
+            }
+            break;
+        }
+        case '*':
+        case '_': {
+            // underscores inside words are not emphasis
+            if (*rest == '_' && i > 0 && isalnum((unsigned char)rest[-1])) {
+                break;
+            }
 
-        // find key-value delimiter
-        char *val = strstr(match, CONF_KV_DELIM);
-        if (val == NULL) {
+            bool is_strong = rest_len > 1 && rest[1] == *rest;
+            char delim[] = {*rest, is_strong ? *rest : '\0', '\0'};
+            size_t delim_len = is_strong ? 2 : 1;
+
+            char *inner = rest + delim_len;
+            char *end = md_closing(inner, rest_len - delim_len, delim);
+            if (end != NULL) {
+                md_inline_tag(out, is_strong ? "strong" : "em", inner,
+                              end - inner);
+                used = end + delim_len - rest;
+            }
+            break;
+        }
+        default:
+            used = md_inline_link(out, rest, rest_len);
             break;
         }
 
-        // skip lines without delimiter
-        if (val > strchr(match, '\n')) {
+        if (used == 0) {
+            ++i;
             continue;
         }
 
-        *val = CONF_NULL_PH; // replace KV delimiter with null-terminator
-
-        // key-value pair
-        struct conf_pair pair = {match, val + CONF_KV_DELIM_LEN};
-        if (conf->pair_count < CONF_MAX) {
-            conf->pairs[conf->pair_count] = pair;
-            ++conf->pair_count;
-        } else {
-            PERROR("too many key-value pairs: key = %s", pair.key);
-        }
+        i += used;
+        plain = i;
     }
 
-    // replace placeholders with null-terminators to make actual C-strings
-    match = conf->buf;
-    while ((match = strchr(match, CONF_NULL_PH)) != NULL) {
-        *match = '\0';
-        ++match;
-    }
+    buf_append(out, mem + plain, len - plain);
 }
 
-static struct conf conf_alloc(char *path) {
-    assert(path != NULL);
+static void md_block_close(struct buf *out, enum md_block block) {
+    assert(out != NULL);
 
-    struct conf conf = {0};
-    char *str = file_alloc(path);
-    if (str == NULL) {
-        return conf;
+    switch (block) {
+    case MD_PARA:
+        md_put_str(out, "</p>\n");
+        break;
+    case MD_UL:
+        md_put_str(out, "</ul>\n");
+        break;
+    case MD_OL:
+        md_put_str(out, "</ol>\n");
+        break;
+    case MD_QUOTE:
+        md_put_str(out, "</p></blockquote>\n");
+        break;
+    case MD_CODE:
+        md_put_str(out, "</code></pre>\n");
+        break;
+    default:
+        break;
     }
-
-    conf_read(&conf, str);
-    return conf;
 }
 
-static void conf_free(struct conf conf) { free(conf.buf); }
+// length of list item marker like "- " or "1. ", zero if none
+static size_t md_list_marker(char *line, size_t len, bool *is_ordered) {
+    assert(line != NULL);
+    assert(is_ordered != NULL);
 
-static char *conf_find(struct conf conf, size_t offset, char *key, char *val) {
-    assert(key != NULL);
+    if (len > 1 && strchr("-*+", line[0]) != NULL && line[1] == ' ') {
+        *is_ordered = false;
+        return 2;
+    }
 
-    for (size_t i = offset; i < conf.pair_count; ++i) {
-        struct conf_pair *pair = &conf.pairs[i];
-        if (strcmp(pair->key, key) == 0) {
-            return pair->val;
-        }
+    size_t i = 0;
+    while (i < len && isdigit((unsigned char)line[i])) {
+        ++i;
     }
 
-    return val;
+    if (i > 0 && i + 1 < len && line[i] == '.' && line[i + 1] == ' ') {
+        *is_ordered = true;
+        return i + 2;
+    }
+
+    return 0;
+}
+
+static bool md_rule(char *line, size_t len) {
+    assert(line != NULL);
+
+    if (len < 3 || strchr("-*_", line[0]) == NULL) {
+        return false;
+    }
+
+    for (size_t i = 1; i < len; ++i) {
+        if (line[i] != line[0]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static enum md_block md_line(struct buf *out, enum md_block block, char *line,
+                             size_t len) {
+    assert(out != NULL);
+    assert(line != NULL);
+
+    bool is_fence = len >= MD_CODE_FENCE_LEN &&
+                    memcmp(line, MD_CODE_FENCE, MD_CODE_FENCE_LEN) == 0;
+
+    // code and html blocks are written as is
+    if (block == MD_CODE) {
+        if (is_fence) {
+            md_block_close(out, block);
+            return MD_NONE;
+        }
+
+        md_put_escaped(out, line, len);
+        md_put_str(out, "\n");
+        return block;
+    }
+
+    if (len == 0) {
+        md_block_close(out, block);
+        return MD_NONE;
+    }
+
+    if (block == MD_HTML || (block == MD_NONE && line[0] == '<')) {
+        buf_append(out, line, len);
+        md_put_str(out, "\n");
+        return MD_HTML;
+    }
+
+    if (is_fence) {
+        md_block_close(out, block);
+        md_put_str(out, "<pre><code>");
+        return MD_CODE;
+    }
+
+    size_t level = 0;
+    while (level < len && level < MD_HEADING_MAX && line[level] == '#') {
+        ++level;
+    }
+
+    if (level > 0 && level < len && line[level] == ' ') {
+        char tag[] = {'h', (char)('0' + level), '\0'};
+        md_block_close(out, block);
+        md_inline_tag(out, tag, line + level + 1, len - level - 1);
+        md_put_str(out, "\n");
+        return MD_NONE;
+    }
+
+    if (md_rule(line, len)) {
+        md_block_close(out, block);
+        md_put_str(out, "<hr>\n");
+        return MD_NONE;
+    }
+
+    bool is_ordered = false;
+    size_t marker = md_list_marker(line, len, &is_ordered);
+    if (marker > 0) {
+        enum md_block list = is_ordered ? MD_OL : MD_UL;
+        if (block != list) {
+            md_block_close(out, block);
+            md_put_str(out, is_ordered ? "<ol>\n" : "<ul>\n");
+        }
+
+        md_inline_tag(out, "li", line + marker, len - marker);
+        md_put_str(out, "\n");
+        return list;
+    }
+
+    if (line[0] == '>') {
+        size_t skip = len > 1 && line[1] == ' ' ? 2 : 1;
+        if (block != MD_QUOTE) {
+            md_block_close(out, block);
+            md_put_str(out, "<blockquote><p>");
+        } else {
+            md_put_str(out, "\n");
+        }
+
+        md_inline(out, line + skip, len - skip);
+        return MD_QUOTE;
+    }
+
+    // lazy continuation of paragraph or quote
+    if (block == MD_PARA || block == MD_QUOTE) {
+        md_put_str(out, "\n");
+        md_inline(out, line, len);
+        return block;
+    }
+
+    md_block_close(out, block);
+    md_put_str(out, "<p>");
+    md_inline(out, line, len);
+    return MD_PARA;
+}
+
+// output buffer is the only allocation
+static char *md_alloc(char *str) {
+    assert(str != NULL);
+
+    struct buf out = {0};
+    buf_realloc(&out, strlen(str) + 1); // usually grows a bit
+    out.len = 0;
+
+    enum md_block block = MD_NONE;
+    while (*str != '\0') {
+        size_t len = strcspn(str, "\n");
+        bool has_nl = str[len] == '\n';
+
+        // ignore CR in CRLF
+        size_t line_len = len > 0 && str[len - 1] == '\r' ? len - 1 : len;
+        block = md_line(&out, block, str, line_len);
+
+        str += len + has_nl;
+    }
+
+    md_block_close(&out, block);
+    return out.buf;
+}
+
+/// Hash map
+
+#define MAP_CAP_MIN 16
+
+struct map_entry {
+    uint64_t hash;
+    char *key; // null-terminated copy, NULL for empty entry
+    size_t key_len;
+    void *val;
+};
+
+struct map {
+    struct map_entry *entries;
+    size_t count;
+    size_t cap; // power of two
+};
+
+// FNV-1a
+static uint64_t hash_mem(char *mem, size_t len) {
+    assert(mem != NULL);
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char)mem[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static struct map_entry *map_entry_find(struct map *map, char *key,
+                                        size_t key_len, uint64_t hash) {
+    assert(map != NULL);
+    assert(map->cap > 0);
+    assert(key != NULL);
+
+    // linear probing, there is always an empty entry
+    size_t mask = map->cap - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct map_entry *entry = &map->entries[i];
+        if (entry->key == NULL) {
+            return entry;
+        }
+
+        if (entry->hash == hash && entry->key_len == key_len &&
+            memcmp(entry->key, key, key_len) == 0) {
+
+            return entry;
+        }
+    }
+}
+
+static void *map_find(struct map *map, char *key, size_t key_len) {
+    assert(map != NULL);
+    assert(key != NULL);
+
+    if (map->count == 0) {
+        return NULL;
+    }
+
+    uint64_t hash = hash_mem(key, key_len);
+    struct map_entry *entry = map_entry_find(map, key, key_len, hash);
+    return entry->val;
+}
+
+static void map_grow(struct map *map) {
+    assert(map != NULL);
+
+    struct map old = *map;
+    map->cap = old.cap > 0 ? old.cap * 2 : MAP_CAP_MIN;
+    map->entries = calloc(map->cap, sizeof(*map->entries));
+
+    for (size_t i = 0; i < old.cap; ++i) {
+        struct map_entry *entry = &old.entries[i];
+        if (entry->key != NULL) {
+            *map_entry_find(map, entry->key, entry->key_len, entry->hash) =
+                *entry;
+        }
+    }
+
+    free(old.entries);
+}
+
+// returns previous value, so caller can free it
+static void *map_put(struct map *map, char *key, size_t key_len, void *val) {
+    assert(map != NULL);
+    assert(key != NULL);
+
+    // keep load factor below 1/2
+    if ((map->count + 1) * 2 > map->cap) {
+        map_grow(map);
+    }
+
+    uint64_t hash = hash_mem(key, key_len);
+    struct map_entry *entry = map_entry_find(map, key, key_len, hash);
+
+    void *old_val = entry->val;
+    if (entry->key == NULL) {
+        entry->hash = hash;
+        entry->key = malloc(key_len + 1);
+        memcpy(entry->key, key, key_len);
+        entry->key[key_len] = '\0';
+        entry->key_len = key_len;
+        ++map->count;
+    }
+
+    entry->val = val;
+    return old_val;
+}
+
+// returns removed value, following entries are moved back, so probing
+// never stops at the removed one
+static void *map_remove(struct map *map, char *key, size_t key_len) {
+    assert(map != NULL);
+    assert(key != NULL);
+
+    if (map->count == 0) {
+        return NULL;
+    }
+
+    uint64_t hash = hash_mem(key, key_len);
+    struct map_entry *entry = map_entry_find(map, key, key_len, hash);
+    if (entry->key == NULL) {
+        return NULL;
+    }
+
+    void *val = entry->val;
+    free(entry->key);
+
+    // entry can fill the hole if the hole is between its home and itself
+    size_t mask = map->cap - 1;
+    size_t hole = entry - map->entries;
+    for (size_t i = (hole + 1) & mask; map->entries[i].key != NULL;
+         i = (i + 1) & mask) {
+
+        size_t home = map->entries[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            map->entries[hole] = map->entries[i];
+            hole = i;
+        }
+    }
+
+    map->entries[hole] = (struct map_entry){0};
+    --map->count;
+    return val;
+}
+
+static void map_free(struct map map, void (*val_free)(void *)) {
+    for (size_t i = 0; i < map.cap; ++i) {
+        struct map_entry *entry = &map.entries[i];
+        if (entry->key == NULL) {
+            continue;
+        }
+
+        if (val_free != NULL) {
+            val_free(entry->val);
+        }
+
+        free(entry->key);
+    }
+
+    free(map.entries);
+}
+
+/// Trace
+
+// Spans are collected from all threads and written in Chrome trace event
+// format, so build timeline can be opened in Perfetto or chrome://tracing:
+//
+//     {"traceEvents":[
+//     {"name":"<name>","cat":"<cat>","ph":"X","ts":<us>,"dur":<us>,
+//      "pid":1,"tid":<tid>},
+//     ...
+//     ]}
+//
+// Span start is 0 when tracing is disabled, so disabled spans cost a branch.
+// Every thread records spans into own buffer without locking, buffers are
+// kept after threads exit and merged when trace is written.
+
+struct trace_event {
+    size_t name; // offset in thread names
+    char *cat;   // static string
+    uint64_t start; // ns since trace start
+    uint64_t dur;   // ns
+};
+
+struct trace_thread {
+    struct trace_event *events;
+    size_t event_count;
+    struct buf names; // NUL terminated event names
+    long tid;
+    struct trace_thread *next;
+};
+
+struct trace {
+    struct trace_thread *threads;
+    uint64_t start;
+    pthread_mutex_t lock; // guards thread list only
+};
+
+static char *s_trace_path = NULL; // NULL if disabled
+static struct trace s_trace = {NULL, 0, PTHREAD_MUTEX_INITIALIZER};
+static pthread_key_t s_trace_key;
+static pthread_once_t s_trace_once = PTHREAD_ONCE_INIT;
+
+static uint64_t trace_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static long trace_tid(void) {
+#if defined(__linux__) && defined(SYS_gettid)
+    return (long)syscall(SYS_gettid);
+#else
+    return (long)(uintptr_t)pthread_self();
+#endif
+}
+
+static void trace_open(char *path) {
+    assert(path != NULL);
+
+    s_trace_path = path;
+    s_trace.start = trace_now();
+}
+
+static uint64_t trace_begin(void) {
+    return s_trace_path != NULL ? trace_now() : 0;
+}
+
+// buffers are owned by thread list, so key has no destructor
+static void trace_key_init(void) {
+    pthread_key_create(&s_trace_key, NULL);
+}
+
+static struct trace_thread *trace_thread(void) {
+    pthread_once(&s_trace_once, trace_key_init);
+
+    struct trace_thread *thread = pthread_getspecific(s_trace_key);
+    if (thread == NULL) {
+        thread = calloc(1, sizeof(*thread));
+        thread->tid = trace_tid();
+        pthread_setspecific(s_trace_key, thread);
+
+        pthread_mutex_lock(&s_trace.lock);
+        thread->next = s_trace.threads;
+        s_trace.threads = thread;
+        pthread_mutex_unlock(&s_trace.lock);
+    }
+
+    return thread;
+}
+
+// name is copied, so it can be any string
+static void trace_span(char *cat, char *name, uint64_t start, uint64_t end) {
+    assert(cat != NULL);
+    assert(name != NULL);
+
+    if (start == 0) {
+        return;
+    }
+
+    struct trace_thread *thread = trace_thread();
+
+    struct trace_event event = {0};
+    event.name = thread->names.len;
+    event.cat = cat;
+    event.start = start - s_trace.start;
+    event.dur = end - start;
+    buf_append(&thread->names, name, strlen(name) + 1);
+
+    thread->events = array_grow(thread->events, thread->event_count,
+                                sizeof(*thread->events));
+    thread->events[thread->event_count] = event;
+    ++thread->event_count;
+}
+
+static void trace_end(char *cat, char *name, uint64_t start) {
+    assert(cat != NULL);
+    assert(name != NULL);
+
+    if (start != 0) {
+        trace_span(cat, name, start, trace_now());
+    }
+}
+
+static void trace_json_write(FILE *file, char *str) {
+    assert(file != NULL);
+    assert(str != NULL);
+
+    for (; *str != '\0'; ++str) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+}
+
+static bool trace_write(void) {
+    assert(s_trace_path != NULL);
+
+    FILE *file = fopen(s_trace_path, "w");
+    if (file == NULL) {
+        PERROR("can't open file: %s", s_trace_path);
+        return false;
+    }
+
+    // threads are done, so their buffers are read without locking
+    char *sep = "";
+    fputs("{\"traceEvents\":[\n", file);
+    for (struct trace_thread *thread = s_trace.threads; thread != NULL;
+         thread = thread->next) {
+
+        for (size_t i = 0; i < thread->event_count; ++i) {
+            struct trace_event *event = &thread->events[i];
+            fprintf(file, "%s{\"name\":\"", sep);
+            trace_json_write(file, thread->names.buf + event->name);
+            fprintf(file,
+                    "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%" PRIu64
+                    ".%03" PRIu64 ",\"dur\":%" PRIu64 ".%03" PRIu64
+                    ",\"pid\":1,\"tid\":%ld}",
+                    event->cat, event->start / 1000, event->start % 1000,
+                    event->dur / 1000, event->dur % 1000, thread->tid);
+            sep = ",\n";
+        }
+    }
+    fputs(*sep != '\0' ? "\n]}\n" : "]}\n", file);
+
+    if (fclose(file) == EOF) {
+        PERROR("can't close file: %s", s_trace_path);
+        return false;
+    }
+
+    return true;
+}
+
+// other threads must be done
+static void trace_free(void) {
+    struct trace_thread *thread = s_trace.threads;
+    while (thread != NULL) {
+        struct trace_thread *next = thread->next;
+        free(thread->events);
+        buf_free(thread->names);
+        free(thread);
+        thread = next;
+    }
+
+    s_trace.threads = NULL;
+    s_trace_path = NULL;
+
+    pthread_once(&s_trace_once, trace_key_init);
+    pthread_setspecific(s_trace_key, NULL);
+}
+
+/// FS
+
+// read file from offset till the end
+static char *file_alloc_at(char *path, long offset, size_t *len) {
+    assert(path != NULL);
+    assert(offset >= 0);
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        PERROR("can't open file: %s", path);
+        return NULL;
+    }
+
+    if (fseek(file, 0, SEEK_END) != 0) {
+        PERROR("fseek failed: %s", path);
+        goto close;
+    }
+
+    // todo: better to read by chunks and realloc
+    long buf_size = ftell(file);
+    if (buf_size == -1) {
+        PERROR("ftell failed: %s", path);
+        goto close;
+    }
+
+    // file could be truncated since offset was taken
+    buf_size = buf_size > offset ? buf_size - offset : 0;
+
+    if (fseek(file, buf_size > 0 ? offset : 0, SEEK_SET) != 0) {
+        PERROR("fseek failed: %s", path);
+        goto close;
+    }
+
+    char *buf = malloc(buf_size + 1);
+    buf[buf_size] = '\0';
+
+    if (buf_size > 0 && fread(buf, buf_size, 1, file) != 1) {
+        PERROR("fread failed: %s", path);
+        goto free;
+    }
+
+    if (fclose(file) == EOF) {
+        PERROR("fclose failed: %s", path);
+        goto free;
+    }
+
+    if (len != NULL) {
+        *len = buf_size;
+    }
+
+    return buf;
+
+    // cleanup
+free:
+    free(buf);
+
+close:
+    fclose(file);
+    return NULL;
+}
+
+static char *file_alloc(char *path, size_t *len) {
+    return file_alloc_at(path, 0, len);
+}
+
+static void mkdir_p(char *path) {
+    assert(path != NULL);
+
+    char buf[PATH_MAX];
+    strcpy_safe(buf, path, sizeof(buf));
+
+    char *match = buf;
+    while ((match = strchr(match, '/')) != NULL) {
+        // skip root of absolute path
+        if (match == buf) {
+            ++match;
+            continue;
+        }
+
+        *match = '\0'; // treat slash as end of the string
+
+        if (mkdir(buf, S_IRWXU) == -1 && errno != EEXIST) {
+            PERROR("can't create dir: %s", buf);
+            return;
+        }
+
+        *match = '/'; // then return it for nested directory
+        ++match;
+    }
+}
+
+static bool fd_write(int fd, char *mem, size_t len) {
+    assert(mem != NULL);
+
+    while (len > 0) {
+        ssize_t written = write(fd, mem, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        mem += written;
+        len -= written;
+    }
+
+    return true;
+}
+
+// path is relative to dir fd, AT_FDCWD for current dir
+static bool file_write(int dir_fd, char *path, char *mem, size_t len) {
+    assert(path != NULL);
+    assert(mem != NULL);
+
+    int fd = openat(dir_fd, path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+        PERROR("can't open file: %s", path);
+        return false;
+    }
+
+    bool is_ok = fd_write(fd, mem, len);
+    if (!is_ok) {
+        PERROR("write failed: %s", path);
+    }
+
+    close(fd);
+    return is_ok;
+}
+
+// DT_DIR or DT_REG, symlinks are followed, stat is used when file system
+// doesn't fill d_type
+static unsigned char dir_entry_type(DIR *dir, struct dirent *entry) {
+    assert(dir != NULL);
+    assert(entry != NULL);
+
+    if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+        return entry->d_type;
+    }
+
+    struct stat st;
+    if (fstatat(dirfd(dir), entry->d_name, &st, 0) == -1) {
+        PERROR("can't stat file: %s", entry->d_name);
+        return DT_UNKNOWN;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        return DT_DIR;
+    }
+
+    return S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+}
+
+// rm -rf relative to dir fd
+static void remove_at(int dir_fd, char *name) {
+    assert(name != NULL);
+
+    if (unlinkat(dir_fd, name, 0) == 0) {
+        return;
+    }
+
+    // posix allows both for directories
+    if (errno != EISDIR && errno != EPERM) {
+        PERROR("can't remove file: %s", name);
+        return;
+    }
+
+    int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY);
+    DIR *dir = fd != -1 ? fdopendir(fd) : NULL;
+    if (dir == NULL) {
+        PERROR("can't open dir: %s", name);
+        if (fd != -1) {
+            close(fd);
+        }
+
+        return;
+    }
+
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0) {
+
+            continue;
+        }
+
+        remove_at(dirfd(dir), entry->d_name);
+    }
+
+    closedir(dir);
+
+    if (unlinkat(dir_fd, name, AT_REMOVEDIR) == -1) {
+        PERROR("can't remove dir: %s", name);
+    }
+}
+
+/// Configuration
+
+#define CONF_FM_DELIM "---\n"
+#define CONF_FM_DELIM_LEN (sizeof(CONF_FM_DELIM) - 1)
+#define CONF_KV_DELIM " = "
+#define CONF_KV_DELIM_LEN (sizeof(CONF_KV_DELIM) - 1)
+
+struct conf_pair {
+    char *key;
+    char *val;
+};
+
+struct conf {
+    struct conf_pair *pairs;
+    size_t pair_count;
+    size_t skip_count; // non-empty front matter lines without delimiter
+    char *content;
+    char *buf;
+    size_t buf_len;
+    long content_offset;   // content position in source file, -1 if none
+    char *content_buf;     // content read from source file, if any
+    struct timespec mtime; // source file mtime, zero if not read
+};
+
+// single pass over front matter, lines are split in place
+static void conf_read(struct conf *conf, char *str) {
+    assert(conf != NULL);
+    assert(str != NULL);
+
+    conf->pair_count = 0;
+    conf->skip_count = 0;
+    conf->content = NULL;
+    conf->buf = str;
+
+    // no front matter, assume everything is a content
+    if (strncmp(conf->buf, CONF_FM_DELIM, CONF_FM_DELIM_LEN) != 0) {
+        conf->content = conf->buf;
+        return;
+    }
+
+    char *line = conf->buf + CONF_FM_DELIM_LEN;
+    while (*line != '\0') {
+        // end of key-value pairs, everything else is a content
+        if (strncmp(line, CONF_FM_DELIM, CONF_FM_DELIM_LEN) == 0) {
+            conf->content = line + CONF_FM_DELIM_LEN;
+            break;
+        }
+
+        // find line end and the first key-value delimiter at once
+        char *delim = NULL;
+        char *end = line;
+        for (; *end != '\n' && *end != '\0'; ++end) {
+            if (delim == NULL &&
+                strncmp(end, CONF_KV_DELIM, CONF_KV_DELIM_LEN) == 0) {
+
+                delim = end;
+            }
+        }
+
+        char *next = *end == '\n' ? end + 1 : end;
+        *end = '\0';
+
+        // skip lines without delimiter, empty lines separate menu entries,
+        // see check_page_conf
+        if (delim == NULL) {
+            conf->skip_count += end != line;
+        } else {
+            *delim = '\0';
+
+            struct conf_pair pair = {line, delim + CONF_KV_DELIM_LEN};
+            conf->pairs = array_grow(conf->pairs, conf->pair_count,
+                                     sizeof(*conf->pairs));
+            conf->pairs[conf->pair_count] = pair;
+            ++conf->pair_count;
+        }
+
+        line = next;
+    }
+}
+
+// read front matter only, content is read later with conf_content_load
+static struct conf conf_alloc(char *path) {
+    assert(path != NULL);
+
+    struct conf conf = {0};
+    conf.content_offset = -1;
+
+    // stat before reading, so the cache never gets newer mtime than content
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        conf.mtime = st.ST_MTIM;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        PERROR("can't open file: %s", path);
+        return conf;
+    }
+
+    struct buf buf = {0};
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &line_cap, file)) > 0) {
+        bool is_delim = strcmp(line, CONF_FM_DELIM) == 0;
+
+        // no front matter, assume everything is a content
+        if (buf.len == 0 && !is_delim) {
+            break;
+        }
+
+        size_t offset = buf.len;
+        buf_realloc(&buf, offset + line_len);
+        memcpy(buf.buf + offset, line, line_len + 1);
+
+        // end of front matter, everything else is a content
+        if (is_delim && offset > 0) {
+            conf.content_offset = ftell(file);
+            break;
+        }
+    }
+
+    if (ferror(file)) {
+        PERROR("can't read file: %s", path);
+    }
+
+    free(line);
+    fclose(file);
+
+    if (buf.buf == NULL) {
+        conf.content_offset = 0;
+        return conf;
+    }
+
+    conf.buf_len = buf.len;
+    conf_read(&conf, buf.buf);
+    conf.content = NULL;
+    return conf;
+}
+
+static void conf_content_load(struct conf *conf, char *path) {
+    assert(conf != NULL);
+    assert(path != NULL);
+
+    if (conf->content != NULL || conf->content_offset < 0) {
+        return;
+    }
+
+    conf->content_buf = file_alloc_at(path, conf->content_offset, NULL);
+    conf->content = conf->content_buf;
+}
+
+static void conf_content_free(struct conf *conf) {
+    assert(conf != NULL);
+
+    // content from buffer stays
+    if (conf->content_buf == NULL) {
+        return;
+    }
+
+    free(conf->content_buf);
+    conf->content_buf = NULL;
+    conf->content = NULL;
+}
+
+static void conf_free(struct conf conf) {
+    free(conf.pairs);
+    free(conf.buf);
+    free(conf.content_buf);
+}
+
+static char *conf_find(struct conf conf, size_t offset, char *key, char *val) {
+    assert(key != NULL);
+
+    for (size_t i = offset; i < conf.pair_count; ++i) {
+        struct conf_pair *pair = &conf.pairs[i];
+        if (strcmp(pair->key, key) == 0) {
+            return pair->val;
+        }
+    }
+
+    return val;
 }
 
 /// Pages
 
-#define PAGE_CHILDREN_MAX 4096 // todo: better to be dynamic
-#define PAGE_SPECIAL_MAX 64
-#define PAGE_SPECIAL_PREFIX '.'
-#define PAGE_INDEX "index.html"
+#define PAGE_SPECIAL_PREFIX '.'
+#define PAGE_INDEX "index.html"
+#define PAGE_EXT ".html"
+#define PAGE_EXT_LEN (sizeof(PAGE_EXT) - 1)
+#define PAGE_MD_EXT ".md"
+#define PAGE_MD_EXT_LEN (sizeof(PAGE_MD_EXT) - 1)
+#define PAGE_MD_INDEX "index" PAGE_MD_EXT
+
+struct page {
+    char name[NAME_MAX];
+    bool is_parent;        // parent can have no children
+    bool is_loaded;        // conf is read, see page_load
+    bool is_markdown;      // source is markdown, rendered to html
+    struct timespec mtime; // source dir mtime, zero for files
+    struct conf conf;
+    struct page *parent;
+    struct page **children;
+    size_t child_count;
+    struct page **special;
+    size_t special_count;
+    char *url;           // root url + page path, ready to emit
+    char *path;          // page path inside output dir, points into url
+    struct buf frag_key; // key of blog list or menu built from this page
+};
+
+static struct page *page_alloc(char *name) {
+    assert(name != NULL);
+
+    struct page *page = calloc(1, sizeof(*page));
+    strcpy_safe(page->name, name, sizeof(page->name));
+    return page;
+}
+
+// markdown sources become html pages with the same name
+static bool page_md_name(char *name, size_t size) {
+    assert(name != NULL);
+
+    size_t len = strlen(name);
+    if (len <= PAGE_MD_EXT_LEN ||
+        strcmp(name + len - PAGE_MD_EXT_LEN, PAGE_MD_EXT) != 0) {
+
+        return false;
+    }
+
+    name[len - PAGE_MD_EXT_LEN] = '\0';
+    strcat_safe(name, PAGE_EXT, size);
+    return true;
+}
+
+// page source path, page file name is replaced with markdown source name
+static void page_src_name(struct page *page, char *path, size_t size) {
+    assert(page != NULL);
+    assert(path != NULL);
+
+    size_t len = strlen(path);
+    if (!page->is_markdown || len < PAGE_EXT_LEN ||
+        strcmp(path + len - PAGE_EXT_LEN, PAGE_EXT) != 0) {
+
+        return;
+    }
+
+    path[len - PAGE_EXT_LEN] = '\0';
+    strcat_safe(path, PAGE_MD_EXT, size);
+}
+
+static void page_free(struct page *page) {
+    if (page == NULL) {
+        return;
+    }
+
+    // free child pages
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        page_free(*child);
+    }
+
+    // free special pages
+    for (size_t i = 0; i < page->special_count; ++i) {
+        struct page **special = &page->special[i];
+        page_free(*special);
+    }
+
+    conf_free(page->conf);
+    buf_free(page->frag_key);
+    free(page->children);
+    free(page->special);
+    free(page->url);
+    free(page);
+}
+
+static bool page_add_special(struct page *page, struct page *special) {
+    assert(page != NULL);
+
+    special->parent = page;
+
+    page->is_parent = true;
+    page->special = array_grow(page->special, page->special_count,
+                               sizeof(*page->special));
+    page->special[page->special_count] = special;
+    ++page->special_count;
+
+    return true;
+}
+
+static bool page_add(struct page *page, struct page *child) {
+    assert(page != NULL);
+
+    if (child == NULL) {
+        return false;
+    }
+
+    if (*child->name == PAGE_SPECIAL_PREFIX) {
+        return page_add_special(page, child);
+    }
+
+    child->parent = page;
+
+    page->is_parent = true;
+    page->children = array_grow(page->children, page->child_count,
+                                sizeof(*page->children));
+    page->children[page->child_count] = child;
+    ++page->child_count;
+
+    return true;
+}
+
+// lazy tree has only structure, confs are read later with page_load
+// todo: not portable, whatever
+static struct page *page_tree_alloc(char *path, char *name, bool is_lazy) {
+    assert(path != NULL);
+    assert(name != NULL);
+
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        PERROR("can't stat dir: %s", path);
+        return NULL;
+    }
+
+    // span includes child dirs
+    uint64_t trace_start = trace_begin();
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        PERROR("can't open dir: %s", path);
+        return NULL;
+    }
+
+    // allocate root page
+    struct page *page = page_alloc(name);
+    page->is_parent = true;
+    page->mtime = st.ST_MTIM;
+
+    char conf_path[PATH_MAX];
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_type == DT_DIR) {
+            // skip special directories
+            if (strcmp(entry->d_name, ".") == 0 ||
+                strcmp(entry->d_name, "..") == 0) {
+
+                continue;
+            }
+
+            // recursively read child directory
+            char dir_path[PATH_MAX];
+            snprintf(dir_path, sizeof(dir_path), "%s/%s", path, entry->d_name);
+            struct page *child =
+                page_tree_alloc(dir_path, entry->d_name, is_lazy);
+            if (!page_add(page, child)) {
+                page_free(child);
+            }
+        } else if (entry->d_type == DT_REG) {
+            // skip page index
+            if (strcmp(entry->d_name, PAGE_INDEX) == 0) {
+                continue;
+            }
+
+            if (strcmp(entry->d_name, PAGE_MD_INDEX) == 0) {
+                page->is_markdown = true;
+                continue;
+            }
+
+            // allocate child page
+            char name[NAME_MAX];
+            strcpy_safe(name, entry->d_name, sizeof(name));
+            bool is_markdown = page_md_name(name, sizeof(name));
+
+            struct page *child = page_alloc(name);
+            child->is_markdown = is_markdown;
+            if (!page_add(page, child)) {
+                page_free(child);
+            } else if (!is_lazy) {
+                // allocate child conf
+                snprintf(conf_path, sizeof(conf_path), "%s/%s", path,
+                         entry->d_name);
+                child->conf = conf_alloc(conf_path);
+                child->is_loaded = true;
+            }
+        }
+    }
+
+    closedir(dir);
+
+    // allocate root conf, markdown index is known only after reading dir
+    if (!is_lazy) {
+        snprintf(conf_path, sizeof(conf_path), "%s/" PAGE_INDEX, path);
+        page_src_name(page, conf_path, sizeof(conf_path));
+        page->conf = conf_alloc(conf_path);
+        page->is_loaded = true;
+    }
+
+    trace_end("scan", path, trace_start);
+    return page;
+}
+
+static char *page_conf(struct page *page, char *key, char *val) {
+    assert(page != NULL);
+    assert(key != NULL);
+
+    while (page != NULL) {
+        char *found = conf_find(page->conf, 0, key, NULL);
+        if (found != NULL) {
+            return found;
+        }
+
+        page = page->parent;
+    }
+
+    return val;
+}
+
+static char *page_content(struct page *page, char *val) {
+    assert(page != NULL);
+
+    struct conf conf = page->conf;
+    if (conf.content != NULL) {
+        return conf.content;
+    }
+
+    return val;
+}
+
+static struct page *page_root(struct page *page) {
+    assert(page != NULL);
+
+    if (page->parent == NULL) {
+        return page;
+    }
+
+    return page_root(page->parent);
+}
+
+static struct page *page_find(struct page *tree, char *path) {
+    assert(tree != NULL);
+    assert(path != NULL);
+
+    // traverse from root if needed
+    if (*path == '/') {
+        struct page *root = page_root(tree);
+        return page_find(root, path + 1);
+    }
+
+    // split path
+    char name[NAME_MAX + 1] = "";
+    char child_path[PATH_MAX + 1] = "";
+    sscanf(path, "%" STR(NAME_MAX) "[^/]/%" STR(PATH_MAX) "s", name,
+           child_path);
+
+    switch (*name) {
+    case '\0':
+        // empty name, found it
+        return tree;
+    case '.':
+        if (name[1] != '\0') {
+            // not a dot name
+        } else if (!tree->is_parent && tree->parent != NULL) {
+            // start from parent if current page is not parent
+            return page_find(tree->parent, child_path);
+        } else {
+            // else just skip it
+            return page_find(tree, child_path);
+        }
+    default:
+        break;
+    }
+
+    // find child page
+    for (size_t i = 0; i < tree->child_count; ++i) {
+        struct page **child = &tree->children[i];
+        if (strcmp((*child)->name, name) == 0) {
+            return page_find(*child, child_path);
+        }
+    }
+
+    // find special page
+    for (size_t i = 0; i < tree->special_count; ++i) {
+        struct page **special = &tree->special[i];
+        if (strcmp((*special)->name, name) == 0) {
+            return page_find(*special, child_path);
+        }
+    }
+
+    // nothing found here, search in parent and so on
+    if (tree->parent != NULL) {
+        return page_find(tree->parent, path);
+    }
+
+    return NULL;
+}
+
+static void page_path_append(struct page *page, char *path, size_t size) {
+    assert(page != NULL);
+    assert(path != NULL);
+    assert(size > 0);
+
+    // don't include root name
+    if (page->parent != NULL) {
+        page_path_append(page->parent, path, size);
+        strcat_safe(path, page->name, size);
+    }
+
+    if (page->is_parent) {
+        strcat_safe(path, "/", size);
+    }
+}
+
+static void page_url_append(struct page *page, char *url, size_t size) {
+    assert(page != NULL);
+    assert(url != NULL);
+    assert(size > 0);
+
+    page_path_append(page, url, size);
+    if (page->is_parent) {
+        strcat_safe(url, PAGE_INDEX, size);
+    }
+}
+
+// must be called once the tree is complete, since is_parent affects urls
+static void page_urls_alloc(struct page *page, char *root_url) {
+    assert(page != NULL);
+    assert(root_url != NULL);
+
+    char url[PATH_MAX];
+    strcpy_safe(url, root_url, sizeof(url));
+    size_t root_len = strlen(url);
+    page_url_append(page, url, sizeof(url));
+
+    free(page->url);
+    page->url = strdup(url);
+    page->path = page->url + root_len;
+
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        page_urls_alloc(*child, root_url);
+    }
+
+    for (size_t i = 0; i < page->special_count; ++i) {
+        struct page **special = &page->special[i];
+        page_urls_alloc(*special, root_url);
+    }
+}
+
+// index by path inside output dir, special pages aren't generated
+static void page_map_add(struct map *map, struct page *page) {
+    assert(map != NULL);
+    assert(page != NULL);
+    assert(page->path != NULL);
+
+    map_put(map, page->path, strlen(page->path), page);
+
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        page_map_add(map, *child);
+    }
+}
+
+// dirs are served by page index, with or without trailing slash
+static struct page *page_map_find(struct map *map, char *path) {
+    assert(map != NULL);
+    assert(path != NULL);
+
+    struct page *page = map_find(map, path, strlen(path));
+    if (page != NULL) {
+        return page;
+    }
+
+    size_t len = strlen(path);
+    char index_path[PATH_MAX];
+    snprintf(index_path, sizeof(index_path), "%s%s" PAGE_INDEX, path,
+             len > 0 && path[len - 1] == '/' ? "" : "/");
+
+    return map_find(map, index_path, strlen(index_path));
+}
+
+// page path is also a source path inside input dir, see page_urls_alloc
+static void page_load(struct page *page, char *in_path) {
+    assert(page != NULL);
+    assert(page->path != NULL);
+    assert(in_path != NULL);
+
+    if (page->is_loaded) {
+        return;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", in_path, page->path);
+    page_src_name(page, path, sizeof(path));
+    page->conf = conf_alloc(path);
+    page->is_loaded = true;
+}
+
+// content is read just before rendering and released right after,
+// markdown is rendered to html right away
+static void page_content_load(struct page *page, char *in_path) {
+    assert(page != NULL);
+    assert(page->path != NULL);
+    assert(in_path != NULL);
+
+    struct conf *conf = &page->conf;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", in_path, page->path);
+    page_src_name(page, path, sizeof(path));
+    conf_content_load(conf, path);
+
+    if (page->is_markdown && conf->content_buf != NULL) {
+        char *html = md_alloc(conf->content_buf);
+        free(conf->content_buf);
+        conf->content_buf = html;
+        conf->content = html;
+    }
+}
+
+static void page_content_free(struct page *page) {
+    assert(page != NULL);
+
+    conf_content_free(&page->conf);
+}
+
+/// Cache
+
+// Parsed site model is dumped as is and mapped back on the next run:
+// header | stamps | nodes | pairs | strings. Stamps are mtimes of every dir and
+// file the model was read from, any mismatch invalidates the whole cache.
+
+#define CACHE_MAGIC 0x33434348 // "HCC3"
+#define CACHE_NONE UINT32_MAX
+
+struct cache_header {
+    uint32_t magic;
+    uint32_t stamp_count;
+    uint32_t node_count;
+    uint32_t pair_count;
+    uint64_t str_size;
+    uint32_t in_path;
+    uint32_t reserved;
+};
+
+struct cache_stamp {
+    int64_t sec; // zero if file didn't exist
+    int64_t nsec;
+    uint32_t path;
+    uint32_t reserved;
+};
+
+struct cache_node {
+    uint32_t parent; // nodes are stored in pre-order, parent goes first
+    uint32_t name;
+    uint32_t is_parent;
+    uint32_t is_markdown;
+    uint32_t pair_index;
+    uint32_t pair_count;
+    uint32_t content_offset; // in source file
+};
+
+struct cache_pair {
+    uint32_t key;
+    uint32_t val;
+};
+
+struct cache {
+    struct cache_stamp *stamps;
+    size_t stamp_count;
+    struct cache_node *nodes;
+    size_t node_count;
+    struct cache_pair *pairs;
+    size_t pair_count;
+    struct buf str;
+};
+
+// cache is mapped globally, loaded pages point into it
+static void *s_cache_map;
+static size_t s_cache_size;
+
+static uint32_t cache_str_add(struct cache *cache, char *str, size_t len) {
+    assert(cache != NULL);
+    assert(str != NULL);
+
+    size_t offset = cache->str.len;
+    buf_realloc(&cache->str, offset + len + 1);
+    memcpy(cache->str.buf + offset, str, len);
+    cache->str.buf[offset + len] = '\0';
+
+    return (uint32_t)offset;
+}
+
+static void cache_stamp_add(struct cache *cache, char *path,
+                            struct timespec mtime) {
+    assert(cache != NULL);
+    assert(path != NULL);
+
+    struct cache_stamp stamp = {0};
+    stamp.sec = mtime.tv_sec;
+    stamp.nsec = mtime.tv_nsec;
+    stamp.path = cache_str_add(cache, path, strlen(path));
+
+    cache->stamps = array_grow(cache->stamps, cache->stamp_count,
+                               sizeof(*cache->stamps));
+    cache->stamps[cache->stamp_count] = stamp;
+    ++cache->stamp_count;
+}
+
+// path is a source dir for parent pages and a source file otherwise
+static void cache_node_add(struct cache *cache, struct page *page,
+                           uint32_t parent, char *path) {
+    assert(cache != NULL);
+    assert(page != NULL);
+    assert(path != NULL);
+
+    struct conf *conf = &page->conf;
+
+    struct cache_node node = {0};
+    node.parent = parent;
+    node.name = cache_str_add(cache, page->name, strlen(page->name));
+    node.is_parent = page->is_parent;
+    node.is_markdown = page->is_markdown;
+    node.pair_index = cache->pair_count;
+    node.pair_count = conf->pair_count;
+    node.content_offset =
+        conf->content_offset >= 0 ? (uint32_t)conf->content_offset : CACHE_NONE;
+
+    if (conf->buf != NULL) {
+        // keys and values are offsets inside the dumped front matter
+        uint32_t buf = cache_str_add(cache, conf->buf, conf->buf_len);
+        for (size_t i = 0; i < conf->pair_count; ++i) {
+            struct cache_pair pair = {0};
+            pair.key = buf + (conf->pairs[i].key - conf->buf);
+            pair.val = buf + (conf->pairs[i].val - conf->buf);
+
+            cache->pairs = array_grow(cache->pairs, cache->pair_count,
+                                      sizeof(*cache->pairs));
+            cache->pairs[cache->pair_count] = pair;
+            ++cache->pair_count;
+        }
+    }
+
+    uint32_t index = cache->node_count;
+    cache->nodes =
+        array_grow(cache->nodes, cache->node_count, sizeof(*cache->nodes));
+    cache->nodes[index] = node;
+    ++cache->node_count;
+
+    if (!page->is_parent) {
+        cache_stamp_add(cache, path, conf->mtime);
+        return;
+    }
+
+    // dir mtime covers added and removed files, including page index
+    cache_stamp_add(cache, path, page->mtime);
+    if (conf->mtime.tv_sec != 0 || conf->mtime.tv_nsec != 0) {
+        char conf_path[PATH_MAX];
+        snprintf(conf_path, sizeof(conf_path), "%s/" PAGE_INDEX, path);
+        page_src_name(page, conf_path, sizeof(conf_path));
+        cache_stamp_add(cache, conf_path, conf->mtime);
+    }
+
+    char child_path[PATH_MAX];
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        snprintf(child_path, sizeof(child_path), "%s/%s", path,
+                 (*child)->name);
+        if (!(*child)->is_parent) {
+            page_src_name(*child, child_path, sizeof(child_path));
+        }
+
+        cache_node_add(cache, *child, index, child_path);
+    }
+
+    for (size_t i = 0; i < page->special_count; ++i) {
+        struct page **special = &page->special[i];
+        snprintf(child_path, sizeof(child_path), "%s/%s", path,
+                 (*special)->name);
+        if (!(*special)->is_parent) {
+            page_src_name(*special, child_path, sizeof(child_path));
+        }
+
+        cache_node_add(cache, *special, index, child_path);
+    }
+}
+
+static void cache_write(struct page *tree, char *in_path, char *path) {
+    assert(tree != NULL);
+    assert(in_path != NULL);
+    assert(path != NULL);
+
+    struct cache cache = {0};
+
+    struct cache_header header = {0};
+    header.magic = CACHE_MAGIC;
+    header.in_path = cache_str_add(&cache, in_path, strlen(in_path));
+
+    cache_node_add(&cache, tree, CACHE_NONE, in_path);
+
+    header.stamp_count = cache.stamp_count;
+    header.node_count = cache.node_count;
+    header.pair_count = cache.pair_count;
+    header.str_size = cache.str.len;
+
+    // write to temporary file first, so readers never see partial cache
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        PERROR("can't open file: %s", tmp_path);
+        goto free;
+    }
+
+    size_t count = fwrite(&header, sizeof(header), 1, file);
+    count += fwrite(cache.stamps, sizeof(*cache.stamps), cache.stamp_count,
+                    file);
+    count += fwrite(cache.nodes, sizeof(*cache.nodes), cache.node_count, file);
+    count += fwrite(cache.pairs, sizeof(*cache.pairs), cache.pair_count, file);
+    count += fwrite(cache.str.buf, 1, cache.str.len, file);
+
+    size_t expected = 1 + cache.stamp_count + cache.node_count +
+                      cache.pair_count + cache.str.len;
+
+    if (fclose(file) == EOF || count != expected) {
+        PERROR("can't write cache: %s", tmp_path);
+        remove(tmp_path);
+        goto free;
+    }
+
+    if (rename(tmp_path, path) == -1) {
+        PERROR("can't rename cache: %s", tmp_path);
+        remove(tmp_path);
+    }
+
+    // cleanup
+free:
+    free(cache.stamps);
+    free(cache.nodes);
+    free(cache.pairs);
+    buf_free(cache.str);
+}
+
+static bool cache_valid(struct cache_header *header, char *str) {
+    assert(header != NULL);
+    assert(str != NULL);
+
+    struct cache_stamp *stamps = (struct cache_stamp *)(header + 1);
+    struct cache_node *nodes = (struct cache_node *)(stamps +
+                                                     header->stamp_count);
+    struct cache_pair *pairs = (struct cache_pair *)(nodes +
+                                                     header->node_count);
+
+    if (header->node_count == 0 || header->in_path >= header->str_size) {
+        return false;
+    }
+
+    // check every offset once, so pages can be built without checks
+    for (size_t i = 0; i < header->stamp_count; ++i) {
+        if (stamps[i].path >= header->str_size) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < header->pair_count; ++i) {
+        if (pairs[i].key >= header->str_size ||
+            pairs[i].val >= header->str_size) {
+
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < header->node_count; ++i) {
+        struct cache_node *node = &nodes[i];
+        bool is_root = node->parent == CACHE_NONE;
+        if (is_root != (i == 0) || (!is_root && node->parent >= i) ||
+            node->name >= header->str_size ||
+            node->pair_index > header->pair_count ||
+            node->pair_count > header->pair_count - node->pair_index) {
+
+            return false;
+        }
+    }
+
+    // then check that sources weren't changed
+    for (size_t i = 0; i < header->stamp_count; ++i) {
+        struct cache_stamp *stamp = &stamps[i];
+
+        struct stat st;
+        if (stat(str + stamp->path, &st) == -1) {
+            if (stamp->sec != 0 || stamp->nsec != 0) {
+                return false;
+            }
+        } else if (st.ST_MTIM.tv_sec != stamp->sec ||
+                   st.ST_MTIM.tv_nsec != stamp->nsec) {
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static struct page *cache_tree_alloc(struct cache_header *header, char *str) {
+    assert(header != NULL);
+    assert(str != NULL);
+
+    struct cache_stamp *stamps = (struct cache_stamp *)(header + 1);
+    struct cache_node *nodes = (struct cache_node *)(stamps +
+                                                     header->stamp_count);
+    struct cache_pair *pairs = (struct cache_pair *)(nodes +
+                                                     header->node_count);
+
+    struct page **pages = malloc(header->node_count * sizeof(*pages));
+    for (size_t i = 0; i < header->node_count; ++i) {
+        struct cache_node *node = &nodes[i];
+
+        struct page *page = page_alloc(str + node->name);
+        page->is_parent = node->is_parent;
+        page->is_markdown = node->is_markdown;
+        page->is_loaded = true;
+
+        // pairs point into the mapped strings
+        struct conf *conf = &page->conf;
+        if (node->pair_count > 0) {
+            conf->pairs = malloc(node->pair_count * sizeof(*conf->pairs));
+        }
+
+        for (size_t j = 0; j < node->pair_count; ++j) {
+            struct cache_pair *pair = &pairs[node->pair_index + j];
+            conf->pairs[j].key = str + pair->key;
+            conf->pairs[j].val = str + pair->val;
+        }
+
+        conf->pair_count = node->pair_count;
+        conf->content_offset = node->content_offset != CACHE_NONE
+                                   ? (long)node->content_offset
+                                   : -1;
+
+        if (i > 0) {
+            struct page *parent = pages[node->parent];
+            if (parent == NULL || !page_add(parent, page)) {
+                page_free(page);
+                page = NULL;
+            }
+        }
+
+        pages[i] = page;
+    }
+
+    struct page *tree = pages[0];
+    free(pages);
+    return tree;
+}
+
+static struct page *cache_load(char *path, char *in_path) {
+    assert(path != NULL);
+    assert(in_path != NULL);
+    assert(s_cache_map == NULL);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            PERROR("can't open cache: %s", path);
+        }
+
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        (size_t)st.st_size < sizeof(struct cache_header)) {
+
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        PERROR("can't map cache: %s", path);
+        return NULL;
+    }
+
+    struct cache_header *header = map;
+    size_t str_offset = sizeof(*header) +
+                        header->stamp_count * sizeof(struct cache_stamp) +
+                        header->node_count * sizeof(struct cache_node) +
+                        header->pair_count * sizeof(struct cache_pair);
+
+    char *str = (char *)map + str_offset;
+    if (header->magic != CACHE_MAGIC || str_offset > size ||
+        size - str_offset != header->str_size || header->str_size == 0 ||
+        str[header->str_size - 1] != '\0' ||
+        !cache_valid(header, str) ||
+        strcmp(str + header->in_path, in_path) != 0) {
+
+        munmap(map, size);
+        return NULL;
+    }
+
+    s_cache_map = map;
+    s_cache_size = size;
+    return cache_tree_alloc(header, str);
+}
+
+static void cache_free(void) {
+    if (s_cache_map != NULL) {
+        munmap(s_cache_map, s_cache_size);
+        s_cache_map = NULL;
+    }
+}
+
+/// Threads
+
+static size_t thread_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+}
+
+// run fn on every available core and wait for all of them
+static void threads_run(void *(*fn)(void *), void *arg) {
+    assert(fn != NULL);
+
+    size_t count = thread_count();
+    pthread_t *threads = malloc(count * sizeof(*threads));
+
+    size_t started = 0;
+    for (; started < count; ++started) {
+        int err = pthread_create(&threads[started], NULL, fn, arg);
+        if (err != 0) {
+            errno = err;
+            PERROR("can't create thread: %zu", started);
+            break;
+        }
+    }
+
+    // still do the work if no threads available
+    if (started == 0) {
+        fn(arg);
+    }
+
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+}
+
+static pthread_key_t s_scratch_key;
+static pthread_once_t s_scratch_once = PTHREAD_ONCE_INIT;
+
+static void scratch_thread_destroy(void *ptr) {
+    scratch_free(ptr);
+    free(ptr);
+}
+
+static void scratch_key_init(void) {
+    pthread_key_create(&s_scratch_key, scratch_thread_destroy);
+}
+
+// every thread renders into own scratch, it's freed when thread exits
+static struct scratch *scratch_thread(void) {
+    pthread_once(&s_scratch_once, scratch_key_init);
+
+    struct scratch *scratch = pthread_getspecific(s_scratch_key);
+    if (scratch == NULL) {
+        scratch = calloc(1, sizeof(*scratch));
+        pthread_setspecific(s_scratch_key, scratch);
+    }
+
+    return scratch;
+}
+
+// main thread doesn't run key destructors
+static void scratch_thread_free(void) {
+    pthread_once(&s_scratch_once, scratch_key_init);
+
+    scratch_thread_destroy(pthread_getspecific(s_scratch_key));
+    pthread_setspecific(s_scratch_key, NULL);
+}
+
+/// Context
+
+// caches shared by all sites using the same theme, see hc_alloc,
+// lookups are safe from any thread
+struct hc {
+    char tpl_path[PATH_MAX];
+    struct map tpls; // template path -> struct tpl
+    pthread_rwlock_t tpl_lock;
+    struct map frags; // fragment key -> rendered fragment
+    pthread_mutex_t frag_lock;
+};
+
+/// Templates
+
+// Templates are compiled to segments: text followed by a placeholder like
+// "{{ key }}" or "{{ key | escape }}", so a page is rendered in one pass.
+
+struct tpl_seg {
+    char *text;
+    size_t text_len;
+    char *ph; // NULL for the last segment
+    size_t ph_len;
+};
+
+struct tpl {
+    char *str; // NULL if template can't be loaded
+    struct tpl_seg *segs;
+    size_t seg_count;
+    bool is_embedded; // compiled into the binary, nothing to free
+};
+
+struct tpl_embed {
+    char *path;
+    char *str;
+    struct tpl_seg *segs;
+    size_t seg_count;
+};
+
+#ifdef HC_THEME
+#include "hc-theme.h" // s_tpl_embeds, generated by make THEME=path
+#endif
+
+static struct tpl_embed *tpl_embed_find(char *path) {
+    assert(path != NULL);
+
+#ifdef HC_THEME
+    for (size_t i = 0; i < ARRAY_LEN(s_tpl_embeds); ++i) {
+        if (strcmp(s_tpl_embeds[i].path, path) == 0) {
+            return &s_tpl_embeds[i];
+        }
+    }
+#else
+    (void)path;
+#endif
+
+    return NULL;
+}
+
+static void tpl_seg_add(struct tpl *tpl, char *text, size_t text_len,
+                        char *ph, size_t ph_len) {
+    assert(tpl != NULL);
+    assert(text != NULL);
+
+    tpl->segs = array_grow(tpl->segs, tpl->seg_count, sizeof(*tpl->segs));
+    tpl->segs[tpl->seg_count] = (struct tpl_seg){text, text_len, ph, ph_len};
+    ++tpl->seg_count;
+}
+
+// split template at every placeholder, which are found the same way
+// strsub finds them
+static void tpl_compile(struct tpl *tpl) {
+    assert(tpl != NULL);
+    assert(tpl->str != NULL);
+
+    char *text = tpl->str;
+    char *open = text;
+    while ((open = strstr(open, STRSUB_PH_OPEN)) != NULL) {
+        char *close = strstr(open + STRSUB_PH_OPEN_LEN, STRSUB_PH_CLOSE);
+        if (close == NULL) {
+            break;
+        }
+
+        // the nearest open to close, like in "{{ {{ key }}"
+        char *inner = open;
+        while ((inner = strstr(inner + 1, STRSUB_PH_OPEN)) != NULL &&
+               inner < close) {
+
+            open = inner;
+        }
+
+        char *end = close + STRSUB_PH_CLOSE_LEN;
+        tpl_seg_add(tpl, text, open - text, open, end - open);
+        text = end;
+        open = end;
+    }
+
+    tpl_seg_add(tpl, text, strlen(text), NULL, 0);
+}
+
+// filesystem theme overrides embedded one
+static struct tpl *tpl_alloc(struct hc *hc, char *path) {
+    assert(hc != NULL);
+    assert(path != NULL);
+
+    struct tpl *tpl = calloc(1, sizeof(*tpl));
+
+    if (*hc->tpl_path != '\0') {
+        char full_path[PATH_MAX];
+        snprintf(full_path, sizeof(full_path), "%s/%s", hc->tpl_path, path);
+
+        struct stat st;
+        if (stat(full_path, &st) == 0 || tpl_embed_find(path) == NULL) {
+            tpl->str = file_alloc(full_path, NULL);
+        }
+    }
+
+    if (tpl->str != NULL) {
+        tpl_compile(tpl);
+        return tpl;
+    }
+
+    struct tpl_embed *embed = tpl_embed_find(path);
+    if (embed != NULL) {
+        tpl->str = embed->str;
+        tpl->segs = embed->segs;
+        tpl->seg_count = embed->seg_count;
+        tpl->is_embedded = true;
+    }
+
+    return tpl;
+}
+
+static void tpl_free(void *ptr) {
+    struct tpl *tpl = ptr;
+    if (tpl == NULL) {
+        return;
+    }
+
+    if (!tpl->is_embedded) {
+        free(tpl->str);
+        free(tpl->segs);
+    }
+
+    free(tpl);
+}
+
+// placeholder matches the pair or its escape filter
+static bool tpl_seg_match(struct tpl_seg *seg, char *find, bool *is_escape) {
+    assert(seg != NULL);
+    assert(find != NULL);
+    assert(is_escape != NULL);
+
+    size_t find_len = strlen(find);
+    if (seg->ph_len == find_len && memcmp(seg->ph, find, find_len) == 0) {
+        *is_escape = false;
+        return true;
+    }
+
+    char filter[] = " | escape" STRSUB_PH_CLOSE;
+    size_t key_len = find_len - STRSUB_PH_CLOSE_LEN;
+    if (find_len > STRSUB_PH_CLOSE_LEN &&
+        seg->ph_len == key_len + sizeof(filter) - 1 &&
+        memcmp(seg->ph, find, key_len) == 0 &&
+        memcmp(seg->ph + key_len, filter, sizeof(filter) - 1) == 0) {
+
+        *is_escape = true;
+        return true;
+    }
+
+    return false;
+}
+
+static bool tpl_uses(struct tpl *tpl, char *find) {
+    assert(tpl != NULL);
+    assert(find != NULL);
+
+    for (size_t i = 0; i < tpl->seg_count; ++i) {
+        bool is_escape = false;
+        struct tpl_seg *seg = &tpl->segs[i];
+        if (seg->ph != NULL && tpl_seg_match(seg, find, &is_escape)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// same result as strsub_scratch: pairs are substituted in order, so value
+// is substituted with the following pairs, result lives in scratch
+static char *tpl_render(struct scratch *scratch, struct tpl *tpl,
+                        struct strsub_pair *pairs, size_t pair_count) {
+    assert(scratch != NULL);
+    assert(tpl != NULL);
+    assert(pairs != NULL);
+
+    struct buf *buf = scratch_buf(scratch);
+    size_t mark = scratch_mark(scratch);
+    for (size_t i = 0; i < tpl->seg_count; ++i) {
+        struct tpl_seg *seg = &tpl->segs[i];
+        buf_append(buf, seg->text, seg->text_len);
+        if (seg->ph == NULL) {
+            continue;
+        }
+
+        size_t j = 0;
+        bool is_escape = false;
+        while (j < pair_count &&
+               !tpl_seg_match(seg, pairs[j].find, &is_escape)) {
+
+            ++j;
+        }
+
+        // unknown placeholders stay as is
+        if (j == pair_count) {
+            buf_append(buf, seg->ph, seg->ph_len);
+            continue;
+        }
+
+        char *rep = pairs[j].rep != NULL ? pairs[j].rep : "";
+        if (is_escape) {
+            struct buf *escaped = scratch_buf(scratch);
+            html_escape_buf(escaped, rep);
+            rep = escaped->buf;
+        }
+
+        if (strstr(rep, STRSUB_PH_OPEN) != NULL) {
+            rep = strsub_scratch(scratch, rep, pairs + j + 1,
+                                 pair_count - j - 1);
+        }
+
+        buf_append(buf, rep, strlen(rep));
+        scratch_release(scratch, mark);
+    }
+
+    return buf->buf;
+}
+
+// value produced on demand, NULL producer means value is already set
+struct tpl_lazy {
+    char *(*rep_alloc)(void *arg);
+    void *arg;
+};
+
+// same as tpl_render, but values with producers are produced only if their
+// placeholders are in template or in any value substituted before them,
+// unused values stay NULL
+static char *tpl_render_lazy(struct scratch *scratch, struct tpl *tpl,
+                             struct strsub_pair *pairs, struct tpl_lazy *lazy,
+                             size_t pair_count) {
+    assert(scratch != NULL);
+    assert(tpl != NULL);
+    assert(pairs != NULL);
+    assert(lazy != NULL);
+
+    for (size_t i = 0; i < pair_count; ++i) {
+        struct strsub_pair *pair = &pairs[i];
+        if (lazy[i].rep_alloc == NULL) {
+            continue;
+        }
+
+        bool is_used = tpl_uses(tpl, pair->find);
+
+        // escaping never changes placeholders inside values
+        char find[STRSUB_FIND_MAX];
+        bool has_escape =
+            strsub_filter_find(find, sizeof(find), pair->find, "escape");
+        for (size_t j = 0; j < i && !is_used; ++j) {
+            char *rep = pairs[j].rep;
+            is_used = rep != NULL && strstr(rep, STRSUB_PH_OPEN) != NULL &&
+                      (strstr(rep, pair->find) != NULL ||
+                       (has_escape && strstr(rep, find) != NULL));
+        }
+
+        if (is_used) {
+            pair->rep = lazy[i].rep_alloc(lazy[i].arg);
+        }
+    }
+
+    // produced values live in scratch below rendered page
+    return tpl_render(scratch, tpl, pairs, pair_count);
+}
+
+// returns NULL if template can't be loaded
+static struct tpl *tpl_cached(struct hc *hc, char *path) {
+    assert(hc != NULL);
+    assert(path != NULL);
+
+    size_t path_len = strlen(path);
+
+    // find cached template
+    pthread_rwlock_rdlock(&hc->tpl_lock);
+    struct tpl *tpl = map_find(&hc->tpls, path, path_len);
+    pthread_rwlock_unlock(&hc->tpl_lock);
+
+    if (tpl != NULL) {
+        return tpl->str != NULL ? tpl : NULL;
+    }
+
+    // load new template without lock and cache it (even if NULL)
+    uint64_t trace_start = trace_begin();
+    struct tpl *new_tpl = tpl_alloc(hc, path);
+    trace_end("template", path, trace_start);
+
+    pthread_rwlock_wrlock(&hc->tpl_lock);
+    tpl = map_find(&hc->tpls, path, path_len);
+    if (tpl == NULL) {
+        map_put(&hc->tpls, path, path_len, new_tpl);
+        tpl = new_tpl;
+        new_tpl = NULL;
+    }
+    pthread_rwlock_unlock(&hc->tpl_lock);
+
+    // other thread was faster
+    tpl_free(new_tpl);
+
+    return tpl->str != NULL ? tpl : NULL;
+}
+
+struct tpl_preload {
+    struct hc *hc;
+    char **paths;
+    size_t path_count;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+static void tpl_preload_add(struct tpl_preload *preload, char *prefix) {
+    assert(preload != NULL);
+    assert(prefix != NULL);
+
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s", preload->hc->tpl_path,
+             prefix);
+
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        PERROR("can't open dir: %s", dir_path);
+        return;
+    }
+
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0) {
+
+            continue;
+        }
+
+        // template path relative to theme dir
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s%s", prefix, entry->d_name);
+
+        unsigned char type = dir_entry_type(dir, entry);
+        if (type == DT_DIR) {
+            strcat_safe(path, "/", sizeof(path));
+            tpl_preload_add(preload, path);
+        } else if (type == DT_REG) {
+            preload->paths = array_grow(preload->paths, preload->path_count,
+                                        sizeof(*preload->paths));
+            preload->paths[preload->path_count] = strdup(path);
+            ++preload->path_count;
+        }
+    }
+
+    closedir(dir);
+}
+
+static void *tpl_preload_worker(void *arg) {
+    struct tpl_preload *preload = arg;
+    assert(preload != NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&preload->lock);
+        size_t i = preload->next;
+        ++preload->next;
+        pthread_mutex_unlock(&preload->lock);
+
+        if (i >= preload->path_count) {
+            return NULL;
+        }
+
+        tpl_cached(preload->hc, preload->paths[i]);
+    }
+}
+
+// load the whole theme dir in parallel instead of on first use
+static void tpl_preload(struct hc *hc) {
+    assert(hc != NULL);
+
+    // embedded theme is compiled already
+    if (*hc->tpl_path == '\0') {
+        return;
+    }
+
+    struct tpl_preload preload = {0};
+    preload.hc = hc;
+    pthread_mutex_init(&preload.lock, NULL);
+
+    tpl_preload_add(&preload, "");
+    threads_run(tpl_preload_worker, &preload);
+
+    for (size_t i = 0; i < preload.path_count; ++i) {
+        free(preload.paths[i]);
+    }
+
+    free(preload.paths);
+    pthread_mutex_destroy(&preload.lock);
+}
+
+/// Fragments
+
+// rendered fragments are cached by template and placeholder values,
+// so identical blog lists and menus are rendered once per site, cached
+// fragment is never replaced, so it can be used without copying
+
+static void frag_key_add(struct buf *key, char *str) {
+    assert(key != NULL);
+
+    // treat NULL as empty string, null-terminator separates values
+    if (str == NULL) {
+        str = "";
+    }
+
+    size_t offset = key->len;
+    size_t len = strlen(str) + 1;
+    buf_realloc(key, offset + len);
+    memcpy(key->buf + offset, str, len);
+}
+
+static char *frag_find(struct hc *hc, struct buf *key) {
+    assert(hc != NULL);
+    assert(key != NULL);
+    assert(key->buf != NULL);
+
+    pthread_mutex_lock(&hc->frag_lock);
+    char *str = map_find(&hc->frags, key->buf, key->len);
+    pthread_mutex_unlock(&hc->frag_lock);
+
+    return str;
+}
+
+// returns cached fragment, which is the given one if it wasn't cached yet
+static char *frag_add(struct hc *hc, struct buf *key, char *str) {
+    assert(hc != NULL);
+    assert(key != NULL);
+    assert(key->buf != NULL);
+
+    if (str == NULL) {
+        return NULL;
+    }
+
+    char *new_str = strdup(str);
+
+    // other thread was faster
+    pthread_mutex_lock(&hc->frag_lock);
+    char *old_str = map_find(&hc->frags, key->buf, key->len);
+    if (old_str == NULL) {
+        map_put(&hc->frags, key->buf, key->len, new_str);
+        new_str = NULL;
+    }
+    pthread_mutex_unlock(&hc->frag_lock);
+
+    free(new_str);
+    return old_str != NULL ? old_str : str;
+}
+
+// sources of the page are changed, so key is built again and old fragment
+// is dropped, nothing may be rendered meanwhile
+static void frag_page_key_free(struct hc *hc, struct page *page) {
+    assert(hc != NULL);
+    assert(page != NULL);
+
+    if (page->frag_key.len == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&hc->frag_lock);
+    free(map_remove(&hc->frags, page->frag_key.buf, page->frag_key.len));
+    pthread_mutex_unlock(&hc->frag_lock);
+
+    buf_free(page->frag_key);
+    page->frag_key = (struct buf){0};
+}
+
+/// Plugins
+
+/// Blog plugin
+
+#define PLUGIN_BLOG_DATE_FORMAT "YYYY-mm-dd"
+#define PLUGIN_BLOG_DATE_LEN sizeof(PLUGIN_BLOG_DATE_FORMAT)
+#define PLUGIN_BLOG_PAGE "blog"
+
+static int compare_page_name(const void *a, const void *b) {
+    assert(a != NULL);
+    assert(b != NULL);
+
+    struct page *page1 = *(struct page **)a;
+    struct page *page2 = *(struct page **)b;
+    assert(page1 != NULL);
+    assert(page2 != NULL);
+
+    return strcmp(page2->name, page1->name);
+}
+
+static char *plugin_blog_list_render(struct scratch *scratch,
+                                     struct page *blog, struct tpl *tpl) {
+    assert(scratch != NULL);
+    assert(blog != NULL);
+    assert(tpl != NULL);
+
+    struct buf *buf = scratch_buf(scratch);
+    size_t mark = scratch_mark(scratch);
+    for (size_t i = 0; i < blog->child_count; ++i) {
+        struct page **post = &blog->children[i];
+
+        char *title = page_conf(*post, "title", NULL);
+
+        char date[PLUGIN_BLOG_DATE_LEN] = "";
+        strcat_safe(date, (*post)->name, sizeof(date));
+
+        struct strsub_pair pairs[] = {
+            {"{{ title }}", title},      //
+            {"{{ date }}", date},        //
+            {"{{ url }}", (*post)->url}, //
+        };
+
+        char *replaced = tpl_render(scratch, tpl, pairs, ARRAY_LEN(pairs));
+        buf_append(buf, replaced, strlen(replaced));
+        scratch_release(scratch, mark);
+    }
+
+    return buf->buf;
+}
+
+// sort posts by date (which is really just a name) once before generation,
+// so pages can be rendered from any thread
+static void plugin_blog_sort(struct page *page) {
+    assert(page != NULL);
+
+    if (strcmp(page->name, PLUGIN_BLOG_PAGE) == 0) {
+        qsort(page->children, page->child_count, sizeof(*page->children),
+              compare_page_name);
+    }
+
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        plugin_blog_sort(*child);
+    }
+}
+
+// key is built once per blog by the first page rendering the list,
+// date is a part of the url, so title and url are enough for the key
+static struct buf *plugin_blog_list_key(struct hc *hc, struct page *blog) {
+    assert(hc != NULL);
+    assert(blog != NULL);
+
+    pthread_mutex_lock(&hc->frag_lock);
+    if (blog->frag_key.len == 0) {
+        frag_key_add(&blog->frag_key, "blog/list.html");
+        for (size_t i = 0; i < blog->child_count; ++i) {
+            struct page **post = &blog->children[i];
+            frag_key_add(&blog->frag_key, page_conf(*post, "title", NULL));
+            frag_key_add(&blog->frag_key, (*post)->url);
+        }
+    }
+    pthread_mutex_unlock(&hc->frag_lock);
+
+    return &blog->frag_key;
+}
+
+static char *plugin_blog_list_alloc(struct hc *hc, struct scratch *scratch,
+                                    struct page *page) {
+    assert(hc != NULL);
+    assert(scratch != NULL);
+    assert(page != NULL);
+
+    struct page *blog = page_find(page, PLUGIN_BLOG_PAGE);
+    if (blog == NULL) {
+        return NULL;
+    }
+
+    struct tpl *tpl = tpl_cached(hc, "blog/list.html");
+    if (tpl == NULL) {
+        return NULL;
+    }
+
+    struct buf *key = plugin_blog_list_key(hc, blog);
+    char *str = frag_find(hc, key);
+    if (str == NULL) {
+        str = plugin_blog_list_render(scratch, blog, tpl);
+        str = frag_add(hc, key, str);
+    }
+
+    return str;
+}
+
+static char *plugin_blog_post_alloc(struct hc *hc, struct scratch *scratch,
+                                    struct page *page) {
+    assert(hc != NULL);
+    assert(scratch != NULL);
+    assert(page != NULL);
+
+    struct tpl *tpl = tpl_cached(hc, "blog/post.html");
+    if (tpl == NULL) {
+        return NULL;
+    }
+
+    char *content = page_content(page, NULL);
+    if (content == NULL) {
+        return NULL;
+    }
+
+    char *title = page_conf(page, "title", NULL);
+
+    char date[PLUGIN_BLOG_DATE_LEN] = "";
+    strcat_safe(date, page->name, sizeof(date));
+
+    struct strsub_pair pairs[] = {
+        {"{{ content }}", content}, //
+        {"{{ title }}", title},     //
+        {"{{ date }}", date},       //
+    };
+
+    return tpl_render(scratch, tpl, pairs, ARRAY_LEN(pairs));
+}
+
+/// Feed plugin
+
+// Atom feed of the most recent blog posts is written next to blog index.
+// Posts are taken in blog list order, dates are taken from post names.
+
+#define PLUGIN_FEED_NAME "feed.xml"
+#define PLUGIN_FEED_TIME "T00:00:00Z"
+
+static size_t s_feed_count = 0; // posts in feed, 0 if disabled
+
+static bool plugin_feed_is_blog(struct page *page) {
+    assert(page != NULL);
+
+    return page->is_parent && strcmp(page->name, PLUGIN_BLOG_PAGE) == 0;
+}
+
+static void plugin_feed_raw_add(struct buf *buf, char *str) {
+    assert(buf != NULL);
+    assert(str != NULL);
+
+    buf_append(buf, str, strlen(str));
+}
+
+// text is escaped, so it's valid xml
+static void plugin_feed_elem_add(struct buf *buf, struct buf *escaped,
+                                 char *tag, char *text) {
+    assert(buf != NULL);
+    assert(escaped != NULL);
+    assert(tag != NULL);
+
+    html_escape_buf(escaped, text != NULL ? text : "");
+
+    plugin_feed_raw_add(buf, "<");
+    plugin_feed_raw_add(buf, tag);
+    plugin_feed_raw_add(buf, ">");
+    buf_append(buf, escaped->buf, escaped->len);
+    plugin_feed_raw_add(buf, "</");
+    plugin_feed_raw_add(buf, tag);
+    plugin_feed_raw_add(buf, ">\n");
+}
+
+static void plugin_feed_link_add(struct buf *buf, struct buf *escaped,
+                                 char *rel, char *url) {
+    assert(buf != NULL);
+    assert(escaped != NULL);
+    assert(rel != NULL);
+    assert(url != NULL);
+
+    html_escape_buf(escaped, url);
+
+    plugin_feed_raw_add(buf, "<link rel=\"");
+    plugin_feed_raw_add(buf, rel);
+    plugin_feed_raw_add(buf, "\" href=\"");
+    buf_append(buf, escaped->buf, escaped->len);
+    plugin_feed_raw_add(buf, "\"/>\n");
+}
+
+// post date is a part of its name, see plugin_blog_list_render
+static void plugin_feed_date(struct page *post, char *date, size_t size) {
+    assert(post != NULL);
+    assert(date != NULL);
+    assert(size >= PLUGIN_BLOG_DATE_LEN);
+
+    *date = '\0';
+    strcat_safe(date, post->name, PLUGIN_BLOG_DATE_LEN);
+    strcat_safe(date, PLUGIN_FEED_TIME, size);
+}
+
+// feed url is blog url with index replaced by feed name
+static void plugin_feed_url(struct page *blog, char *url, size_t size) {
+    assert(blog != NULL);
+    assert(blog->url != NULL);
+    assert(url != NULL);
+
+    char *name = strrchr(blog->url, '/') + 1;
+    snprintf(url, size, "%.*s" PLUGIN_FEED_NAME, (int)(name - blog->url),
+             blog->url);
+}
+
+// feed lives in scratch, posts must be loaded
+static char *plugin_feed_alloc(struct scratch *scratch, struct page *blog,
+                               size_t count) {
+    assert(scratch != NULL);
+    assert(blog != NULL);
+
+    struct buf *buf = scratch_buf(scratch);
+    struct buf *escaped = scratch_buf(scratch);
+
+    char url[PATH_MAX];
+    plugin_feed_url(blog, url, sizeof(url));
+
+    // feed is updated with the newest post
+    char date[PLUGIN_BLOG_DATE_LEN + sizeof(PLUGIN_FEED_TIME)] =
+        "1970-01-01" PLUGIN_FEED_TIME;
+    if (blog->child_count > 0) {
+        plugin_feed_date(blog->children[0], date, sizeof(date));
+    }
+
+    char *name = page_conf(blog, "site.name", NULL);
+    char *author = page_conf(blog, "author", name);
+
+    plugin_feed_raw_add(buf, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+    plugin_feed_raw_add(buf, "<feed xmlns=\"http://www.w3.org/2005/Atom\">\n");
+    plugin_feed_elem_add(buf, escaped, "title", name);
+    plugin_feed_elem_add(buf, escaped, "id", url);
+    plugin_feed_link_add(buf, escaped, "self", url);
+    plugin_feed_elem_add(buf, escaped, "updated", date);
+    plugin_feed_raw_add(buf, "<author>\n");
+    plugin_feed_elem_add(buf, escaped, "name", author);
+    plugin_feed_raw_add(buf, "</author>\n");
+
+    // posts are sorted from the newest one
+    for (size_t i = 0; i < blog->child_count && i < count; ++i) {
+        struct page *post = blog->children[i];
+        plugin_feed_date(post, date, sizeof(date));
+
+        plugin_feed_raw_add(buf, "<entry>\n");
+        plugin_feed_elem_add(buf, escaped, "title",
+                             page_conf(post, "title", NULL));
+        plugin_feed_elem_add(buf, escaped, "id", post->url);
+        plugin_feed_link_add(buf, escaped, "alternate", post->url);
+        plugin_feed_elem_add(buf, escaped, "updated", date);
+
+        // inherited description isn't about the post
+        char *desc = conf_find(post->conf, 0, "meta.description", NULL);
+        if (desc != NULL) {
+            plugin_feed_elem_add(buf, escaped, "summary", desc);
+        }
+
+        plugin_feed_raw_add(buf, "</entry>\n");
+    }
+
+    plugin_feed_raw_add(buf, "</feed>\n");
+    return buf->buf;
+}
+
+/// Page plugin
+
+static char *plugin_page_alloc(struct hc *hc, struct scratch *scratch,
+                               struct page *page) {
+    assert(hc != NULL);
+    assert(scratch != NULL);
+    assert(page != NULL);
+
+    struct tpl *tpl = tpl_cached(hc, "page.html");
+    if (tpl == NULL) {
+        return NULL;
+    }
+
+    char *content = page_content(page, NULL);
+    if (content == NULL) {
+        return NULL;
+    }
+
+    char *title = page_conf(page, "title", NULL);
+    struct strsub_pair pairs[] = {
+        {"{{ content }}", content}, //
+        {"{{ title }}", title},     //
+    };
+
+    return tpl_render(scratch, tpl, pairs, ARRAY_LEN(pairs));
+}
+
+/// Menu plugin
+
+static char *plugin_menu_url(struct page *menu, size_t offset) {
+    assert(menu != NULL);
+
+    char *page_url = conf_find(menu->conf, offset, "url", NULL);
+    char *page_path = conf_find(menu->conf, offset, "page", NULL);
+
+    if (page_path != NULL) {
+        struct page *target_page = page_find(menu, page_path);
+        if (target_page != NULL) {
+            return target_page->url;
+        }
+    } else if (page_url != NULL) {
+        return page_url;
+    }
+
+    return "#";
+}
+
+static char *plugin_menu_render(struct scratch *scratch, struct page *menu,
+                                struct tpl *tpl) {
+    assert(scratch != NULL);
+    assert(menu != NULL);
+    assert(tpl != NULL);
+
+    struct buf *buf = scratch_buf(scratch);
+    size_t mark = scratch_mark(scratch);
+    for (size_t i = 0; i < menu->conf.pair_count; i += 2) {
+        char *title = conf_find(menu->conf, i, "title", NULL);
+        char *url = plugin_menu_url(menu, i);
+
+        struct strsub_pair pairs[] = {
+            {"{{ title }}", title}, //
+            {"{{ url }}", url},     //
+        };
+
+        char *replaced = tpl_render(scratch, tpl, pairs, ARRAY_LEN(pairs));
+        buf_append(buf, replaced, strlen(replaced));
+        scratch_release(scratch, mark);
+    }
+
+    return buf->buf;
+}
+
+// key is built once per menu by the first page rendering it
+static struct buf *plugin_menu_key(struct hc *hc, struct page *menu) {
+    assert(hc != NULL);
+    assert(menu != NULL);
+
+    pthread_mutex_lock(&hc->frag_lock);
+    if (menu->frag_key.len == 0) {
+        frag_key_add(&menu->frag_key, "menu.html");
+        for (size_t i = 0; i < menu->conf.pair_count; i += 2) {
+            frag_key_add(&menu->frag_key,
+                         conf_find(menu->conf, i, "title", NULL));
+            frag_key_add(&menu->frag_key, plugin_menu_url(menu, i));
+        }
+    }
+    pthread_mutex_unlock(&hc->frag_lock);
+
+    return &menu->frag_key;
+}
+
+static char *plugin_menu_alloc(struct hc *hc, struct scratch *scratch,
+                               struct page *page) {
+    assert(hc != NULL);
+    assert(scratch != NULL);
+    assert(page != NULL);
+
+    struct page *menu = page_find(page, ".menu.html");
+    if (menu == NULL) {
+        return NULL;
+    }
+
+    struct tpl *tpl = tpl_cached(hc, "menu.html");
+    if (tpl == NULL) {
+        return NULL;
+    }
+
+    struct buf *key = plugin_menu_key(hc, menu);
+    char *str = frag_find(hc, key);
+    if (str == NULL) {
+        str = plugin_menu_render(scratch, menu, tpl);
+        str = frag_add(hc, key, str);
+    }
+
+    return str;
+}
+
+/// Home plugin
+
+static char *plugin_home_alloc(struct hc *hc, struct scratch *scratch,
+                               struct page *page) {
+    assert(hc != NULL);
+    assert(scratch != NULL);
+    assert(page != NULL);
+
+    struct tpl *tpl = tpl_cached(hc, "home.html");
+    if (tpl == NULL) {
+        return NULL;
+    }
+
+    char *content = page_content(page, NULL);
+    struct strsub_pair pairs[] = {
+        {"{{ content }}", content}, //
+    };
+
+    return tpl_render(scratch, tpl, pairs, ARRAY_LEN(pairs));
+}
+
+/// Base plugin
+
+#define PLUGIN_BASE_TITLE_MAX 128
+
+struct plugin_base {
+    struct hc *hc;
+    struct scratch *scratch;
+    struct page *page;
+};
+
+// values are produced only if base template needs them
+
+static char *plugin_base_footer(void *arg) {
+    struct plugin_base *base = arg;
+    return page_conf(base->page, "footer", NULL);
+}
+
+static char *plugin_base_blog(void *arg) {
+    struct plugin_base *base = arg;
+    uint64_t trace_start = trace_begin();
+    char *blog = plugin_blog_list_alloc(base->hc, base->scratch, base->page);
+    trace_end("plugin", "blog list", trace_start);
+    return blog;
+}
+
+static char *plugin_base_menu(void *arg) {
+    struct plugin_base *base = arg;
+    uint64_t trace_start = trace_begin();
+    char *menu = plugin_menu_alloc(base->hc, base->scratch, base->page);
+    trace_end("plugin", "menu", trace_start);
+    return menu;
+}
+
+static char *plugin_base_desc(void *arg) {
+    struct plugin_base *base = arg;
+    return page_conf(base->page, "meta.description", NULL);
+}
+
+static char *plugin_base_title(void *arg) {
+    struct plugin_base *base = arg;
+    struct page *page = base->page;
+
+    struct buf *buf = scratch_buf(base->scratch);
+    buf_realloc(buf, PLUGIN_BASE_TITLE_MAX);
+
+    char *title = buf->buf;
+    char *site_name = page_conf(page, "site.name", NULL);
+    if (page->parent != NULL) {
+        char *page_title = page_conf(page, "title", NULL);
+        char *title_delim = page_conf(page, "site.title.delimiter", " | ");
+        strcat_safe(title, page_title, PLUGIN_BASE_TITLE_MAX);
+        strcat_safe(title, title_delim, PLUGIN_BASE_TITLE_MAX);
+        strcat_safe(title, site_name, PLUGIN_BASE_TITLE_MAX);
+    } else {
+        strcat_safe(title, site_name, PLUGIN_BASE_TITLE_MAX);
+    }
+
+    return title;
+}
+
+static char *plugin_base_name(void *arg) {
+    struct plugin_base *base = arg;
+    return page_conf(base->page, "site.name", NULL);
+}
+
+static char *plugin_base_lang(void *arg) {
+    struct plugin_base *base = arg;
+    return page_conf(base->page, "language", "en");
+}
+
+// page is rendered into scratch, it lives until scratch is reset
+static char *plugin_base_alloc(struct hc *hc, struct scratch *scratch,
+                               struct page *page) {
+    assert(hc != NULL);
+    assert(scratch != NULL);
+    assert(page != NULL);
+
+    struct tpl *tpl = tpl_cached(hc, "base.html");
+    if (tpl == NULL) {
+        return NULL;
+    }
+
+    uint64_t trace_start = trace_begin();
+    char *plugin = NULL;
+    char *content = NULL;
+    if (page->parent == NULL) {
+        // home page
+        plugin = "home";
+        content = plugin_home_alloc(hc, scratch, page);
+    } else if (strcmp(page->parent->name, PLUGIN_BLOG_PAGE) == 0) {
+        // blog page
+        plugin = "blog post";
+        content = plugin_blog_post_alloc(hc, scratch, page);
+    } else {
+        // simple page
+        plugin = "page";
+        content = plugin_page_alloc(hc, scratch, page);
+    }
+
+    trace_end("plugin", plugin, trace_start);
+
+    if (content == NULL) {
+        return NULL;
+    }
+
+    // root url is the part of page url before page path,
+    // so sites with different root urls can be generated together
+    char root_url[PATH_MAX];
+    snprintf(root_url, sizeof(root_url), "%.*s",
+             (int)(page->path - page->url), page->url);
+
+    struct plugin_base base = {hc, scratch, page};
+    struct strsub_pair pairs[] = {
+        {"{{ content }}", content},  //
+        {"{{ footer }}", NULL},      //
+        {"{{ blog }}", NULL},        //
+        {"{{ menu }}", NULL},        //
+        {"{{ description }}", NULL}, //
+        {"{{ title }}", NULL},       //
+        {"{{ name }}", NULL},        //
+        {"{{ root }}", root_url},    //
+        {"{{ language }}", NULL},    //
+    };
+
+    struct tpl_lazy lazy[] = {
+        {NULL, NULL},                //
+        {plugin_base_footer, &base}, //
+        {plugin_base_blog, &base},   //
+        {plugin_base_menu, &base},   //
+        {plugin_base_desc, &base},   //
+        {plugin_base_title, &base},  //
+        {plugin_base_name, &base},   //
+        {NULL, NULL},                //
+        {plugin_base_lang, &base},   //
+    };
+
+    assert(ARRAY_LEN(pairs) == ARRAY_LEN(lazy));
+    return tpl_render_lazy(scratch, tpl, pairs, lazy, ARRAY_LEN(pairs));
+}
+
+/// Manifest
+
+// Every written file is listed with its status relative to the previous
+// manifest, one line per file sorted by url:
+//
+//     <status>\t<hash>\t<size>\t<url>
+//
+// Status is added, changed, unchanged or removed. Hash is FNV-1a of file
+// content in hex. Removed files are listed once with their previous hash.
+
+#define MANIFEST_ADDED "added"
+#define MANIFEST_CHANGED "changed"
+#define MANIFEST_UNCHANGED "unchanged"
+#define MANIFEST_REMOVED "removed"
+#define MANIFEST_STATUS_MAX 16
+
+struct manifest_entry {
+    char *url; // points to map key
+    char *status;
+    uint64_t hash;
+    size_t size;
+};
+
+static char *s_manifest_path = NULL; // NULL if disabled
+static struct map s_manifest;        // url -> struct manifest_entry
+
+// entries are keyed by path until manifest is written
+static void manifest_add(char *path, char *mem, size_t len) {
+    assert(path != NULL);
+    assert(mem != NULL);
+
+    struct manifest_entry *entry = calloc(1, sizeof(*entry));
+    entry->hash = hash_mem(mem, len);
+    entry->size = len;
+    free(map_put(&s_manifest, path, strlen(path), entry));
+}
+
+// previous entries, removed ones are skipped
+static struct map manifest_read(char *path) {
+    assert(path != NULL);
+
+    struct map prev = {0};
+
+    struct stat st;
+    char *str = stat(path, &st) == 0 ? file_alloc(path, NULL) : NULL;
+    if (str == NULL) {
+        return prev;
+    }
+
+    char *line = str;
+    while (*line != '\0') {
+        char *end = line + strcspn(line, "\n");
+        bool has_nl = *end == '\n';
+        *end = '\0';
+
+        char status[MANIFEST_STATUS_MAX];
+        struct manifest_entry entry = {0};
+        int url_offset = 0;
+        if (sscanf(line, "%15[^\t]\t%" SCNx64 "\t%zu\t%n", status, &entry.hash,
+                   &entry.size, &url_offset) == 3 &&
+            url_offset > 0 && strcmp(status, MANIFEST_REMOVED) != 0) {
+
+            char *url = line + url_offset;
+            struct manifest_entry *prev_entry = malloc(sizeof(*prev_entry));
+            *prev_entry = entry;
+            free(map_put(&prev, url, strlen(url), prev_entry));
+        }
+
+        line = end + has_nl;
+    }
+
+    free(str);
+    return prev;
+}
+
+static int compare_manifest_entry(const void *a, const void *b) {
+    struct manifest_entry *entry_a = *(struct manifest_entry **)a;
+    struct manifest_entry *entry_b = *(struct manifest_entry **)b;
+    return strcmp(entry_a->url, entry_b->url);
+}
+
+// files not written by partial builds stay in output dir, so they're unchanged
+static void manifest_write(char *root_url, bool is_full) {
+    assert(root_url != NULL);
+    assert(s_manifest_path != NULL);
+
+    struct map prev = manifest_read(s_manifest_path);
+
+    // compare by urls, since root url can change between builds
+    struct map paths = s_manifest;
+    s_manifest = (struct map){0};
+    for (size_t i = 0; i < paths.cap; ++i) {
+        struct map_entry *map_entry = &paths.entries[i];
+        if (map_entry->key != NULL) {
+            char url[PATH_MAX];
+            snprintf(url, sizeof(url), "%s%s", root_url, map_entry->key);
+            map_put(&s_manifest, url, strlen(url), map_entry->val);
+        }
+    }
+
+    map_free(paths, NULL);
+
+    for (size_t i = 0; i < s_manifest.cap; ++i) {
+        struct map_entry *map_entry = &s_manifest.entries[i];
+        if (map_entry->key == NULL) {
+            continue;
+        }
+
+        struct manifest_entry *entry = map_entry->val;
+        struct manifest_entry *prev_entry =
+            map_find(&prev, map_entry->key, map_entry->key_len);
+
+        if (prev_entry == NULL) {
+            entry->status = MANIFEST_ADDED;
+        } else if (prev_entry->hash != entry->hash ||
+                   prev_entry->size != entry->size) {
+            entry->status = MANIFEST_CHANGED;
+        } else {
+            entry->status = MANIFEST_UNCHANGED;
+        }
+    }
+
+    for (size_t i = 0; i < prev.cap; ++i) {
+        struct map_entry *map_entry = &prev.entries[i];
+        if (map_entry->key == NULL ||
+            map_find(&s_manifest, map_entry->key, map_entry->key_len) != NULL) {
+            continue;
+        }
+
+        struct manifest_entry *entry = malloc(sizeof(*entry));
+        *entry = *(struct manifest_entry *)map_entry->val;
+        entry->status = is_full ? MANIFEST_REMOVED : MANIFEST_UNCHANGED;
+        map_put(&s_manifest, map_entry->key, map_entry->key_len, entry);
+    }
+
+    // sort by url, entries point to map keys only from now on
+    struct manifest_entry **entries =
+        malloc((s_manifest.count + 1) * sizeof(*entries));
+    size_t entry_count = 0;
+    for (size_t i = 0; i < s_manifest.cap; ++i) {
+        struct map_entry *map_entry = &s_manifest.entries[i];
+        if (map_entry->key != NULL) {
+            struct manifest_entry *entry = map_entry->val;
+            entry->url = map_entry->key;
+            entries[entry_count] = entry;
+            ++entry_count;
+        }
+    }
+
+    qsort(entries, entry_count, sizeof(*entries), compare_manifest_entry);
+
+    // write to temporary file first, so deploy never sees partial manifest
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", s_manifest_path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        PERROR("can't open file: %s", tmp_path);
+        goto free;
+    }
+
+    for (size_t i = 0; i < entry_count; ++i) {
+        struct manifest_entry *entry = entries[i];
+        fprintf(file, "%s\t%016" PRIx64 "\t%zu\t%s\n", entry->status,
+                entry->hash, entry->size, entry->url);
+    }
+
+    if (fclose(file) == EOF) {
+        PERROR("can't write manifest: %s", tmp_path);
+        remove(tmp_path);
+        goto free;
+    }
+
+    if (rename(tmp_path, s_manifest_path) == -1) {
+        PERROR("can't rename manifest: %s", tmp_path);
+        remove(tmp_path);
+    }
+
+    // cleanup
+free:
+    free(entries);
+    map_free(prev, free);
+}
+
+static void manifest_free(void) {
+    map_free(s_manifest, free);
+    s_manifest = (struct map){0};
+}
+
+/// Output
+
+// ustar format, see tar(5)
+#define TAR_BLOCK 512
+
+struct tar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+static bool tar_header_path(struct tar_header *header, char *path) {
+    assert(header != NULL);
+    assert(path != NULL);
+
+    size_t len = strlen(path);
+    if (len < sizeof(header->name)) {
+        memcpy(header->name, path, len);
+        return true;
+    }
+
+    // split long path into prefix and name on the first suitable slash
+    char *slash = path;
+    while ((slash = strchr(slash, '/')) != NULL) {
+        size_t prefix_len = slash - path;
+        if (prefix_len > sizeof(header->prefix)) {
+            break;
+        }
+
+        size_t name_len = len - prefix_len - 1;
+        if (name_len < sizeof(header->name)) {
+            memcpy(header->prefix, path, prefix_len);
+            memcpy(header->name, slash + 1, name_len);
+            return true;
+        }
+
+        ++slash;
+    }
+
+    return false;
+}
+
+static bool tar_write(FILE *tar, time_t mtime, char *path, char *mem,
+                      size_t len) {
+    assert(tar != NULL);
+    assert(path != NULL);
+    assert(mem != NULL);
+
+    struct tar_header header = {0};
+    if (!tar_header_path(&header, path)) {
+        fprintf(stderr, "path is too long for tar: %s\n", path);
+        return false;
+    }
+
+    snprintf(header.mode, sizeof(header.mode), "%07o", 0644);
+    snprintf(header.uid, sizeof(header.uid), "%07o", 0);
+    snprintf(header.gid, sizeof(header.gid), "%07o", 0);
+    snprintf(header.size, sizeof(header.size), "%011llo",
+             (unsigned long long)len);
+    snprintf(header.mtime, sizeof(header.mtime), "%011llo",
+             (unsigned long long)mtime);
+    header.typeflag = '0';
+    memcpy(header.magic, "ustar", sizeof(header.magic));
+    memcpy(header.version, "00", sizeof(header.version));
+
+    // checksum is calculated with chksum field filled with spaces
+    memset(header.chksum, ' ', sizeof(header.chksum));
+    unsigned int chksum = 0;
+    unsigned char *bytes = (unsigned char *)&header;
+    for (size_t i = 0; i < sizeof(header); ++i) {
+        chksum += bytes[i];
+    }
+
+    snprintf(header.chksum, sizeof(header.chksum), "%06o", chksum);
+
+    // data is padded to the whole block
+    char pad[TAR_BLOCK] = {0};
+    size_t pad_len = (TAR_BLOCK - len % TAR_BLOCK) % TAR_BLOCK;
+
+    if (fwrite(&header, sizeof(header), 1, tar) != 1 ||
+        (len > 0 && fwrite(mem, len, 1, tar) != 1) ||
+        (pad_len > 0 && fwrite(pad, pad_len, 1, tar) != 1)) {
+
+        PERROR("can't write to tar: %s", path);
+        return false;
+    }
+
+    return true;
+}
+
+static bool tar_finish(FILE *tar) {
+    assert(tar != NULL);
+
+    // end of archive is marked with two empty blocks
+    char end[TAR_BLOCK * 2] = {0};
+    if (fwrite(end, sizeof(end), 1, tar) != 1) {
+        PERROR("can't write to tar: %s", "end of archive");
+        return false;
+    }
+
+    return true;
+}
+
+// output dir is written through cached dir fds, full builds go to staging
+// dir first and then replace output dir at once, staging dir is dropped if
+// any write fails, so output dir is either old or complete
+#define OUT_DIRS_MAX 256 // stay far from open files limit
+
+struct out {
+    FILE *tar; // output is written to archive instead of output dir if set
+    time_t tar_mtime;
+    FILE *stream; // pages are just concatenated if set
+    int fd;
+    char path[PATH_MAX];
+    char staging[PATH_MAX]; // empty if output is written in place
+    struct map dirs;        // relative dir path -> int fd
+    pthread_mutex_t lock;   // pages can be written from any thread
+    bool is_failed;         // some write failed, output isn't published
+};
+
+static void out_dirs_free(struct out *out) {
+    assert(out != NULL);
+
+    for (size_t i = 0; i < out->dirs.cap; ++i) {
+        struct map_entry *entry = &out->dirs.entries[i];
+        if (entry->key != NULL) {
+            close(*(int *)entry->val);
+        }
+    }
+
+    map_free(out->dirs, free);
+    out->dirs = (struct map){0};
+}
+
+// tar "-" means stdout, same for output dir
+static bool out_open(struct out *out, char *out_path, char *tar_path,
+                     bool is_staged) {
+    assert(out != NULL);
+    assert(out_path != NULL);
+
+    *out = (struct out){0};
+    out->fd = -1;
+    out->tar_mtime = time(NULL);
+    pthread_mutex_init(&out->lock, NULL);
+
+    if (tar_path != NULL && strcmp(tar_path, "-") == 0) {
+        out->tar = stdout;
+        return true;
+    }
+
+    if (tar_path != NULL) {
+        out->tar = fopen(tar_path, "wb");
+        if (out->tar == NULL) {
+            PERROR("can't open file: %s", tar_path);
+            return false;
+        }
+
+        return true;
+    }
+
+    if (strcmp(out_path, "-") == 0) {
+        out->stream = stdout;
+        return true;
+    }
+
+    // staging dir is created next to output dir, so rename is possible
+    strcpy_safe(out->path, out_path, sizeof(out->path));
+    size_t out_len = strlen(out->path);
+    while (out_len > 1 && out->path[out_len - 1] == '/') {
+        out->path[--out_len] = '\0';
+    }
+
+    mkdir_p(out->path);
+
+    char *dir_path = out->path;
+    if (is_staged) {
+        snprintf(out->staging, sizeof(out->staging), "%s.XXXXXX",
+                 out->path);
+        if (mkdtemp(out->staging) == NULL) {
+            PERROR("can't create dir: %s", out->staging);
+            return false;
+        }
+
+        dir_path = out->staging;
+    } else if (mkdir(out->path, S_IRWXU) == -1 && errno != EEXIST) {
+        PERROR("can't create dir: %s", out->path);
+        return false;
+    }
+
+    out->fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+    if (out->fd == -1) {
+        PERROR("can't open dir: %s", dir_path);
+        return false;
+    }
+
+    return true;
+}
+
+// path is relative to output dir, without leading and trailing slashes
+static int out_dir_fd(struct out *out, char *path, size_t len) {
+    assert(out != NULL);
+    assert(path != NULL);
+
+    if (len == 0) {
+        return out->fd;
+    }
+
+    int *cached_fd = map_find(&out->dirs, path, len);
+    if (cached_fd != NULL) {
+        return *cached_fd;
+    }
+
+    // open parent first
+    size_t parent_len = len;
+    while (parent_len > 0 && path[parent_len - 1] != '/') {
+        --parent_len;
+    }
+
+    char *name_start = path + parent_len;
+    int parent_fd = out_dir_fd(out, path, parent_len > 0 ? parent_len - 1 : 0);
+    if (parent_fd == -1) {
+        return -1;
+    }
+
+    char name[NAME_MAX + 1] = "";
+    snprintf(name, sizeof(name), "%.*s", (int)(len - parent_len), name_start);
+
+    if (mkdirat(parent_fd, name, S_IRWXU) == -1 && errno != EEXIST) {
+        PERROR("can't create dir: %s", name);
+        return -1;
+    }
+
+    int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        PERROR("can't open dir: %s", name);
+        return -1;
+    }
+
+    // pages are generated in tree order, so dropping everything is cheap
+    if (out->dirs.count >= OUT_DIRS_MAX) {
+        out_dirs_free(out);
+    }
+
+    int *new_fd = malloc(sizeof(*new_fd));
+    *new_fd = fd;
+    map_put(&out->dirs, path, len, new_fd);
+
+    return fd;
+}
+
+// path is relative to output dir and starts with slash
+static void out_write(struct out *out, char *path, char *mem, size_t len) {
+    assert(out != NULL);
+    assert(path != NULL);
+    assert(*path == '/');
+    assert(mem != NULL);
+
+    // waiting for other writers is traced separately,
+    // spans are recorded once lock is released
+    uint64_t wait_start = trace_begin();
+    pthread_mutex_lock(&out->lock);
+    uint64_t write_start = trace_begin();
+
+    if (s_manifest_path != NULL) {
+        manifest_add(path, mem, len);
+    }
+
+    bool is_ok = true;
+    if (out->tar != NULL) {
+        is_ok = tar_write(out->tar, out->tar_mtime, path + 1, mem, len);
+    } else if (out->stream != NULL) {
+        if (len > 0 && fwrite(mem, len, 1, out->stream) != 1) {
+            PERROR("can't write to stream: %s", path);
+            is_ok = false;
+        }
+    } else {
+        char *name = strrchr(path, '/') + 1;
+        size_t dir_len = name - path > 1 ? name - path - 2 : 0;
+        int dir_fd = out_dir_fd(out, path + 1, dir_len);
+        is_ok = dir_fd != -1 && file_write(dir_fd, name, mem, len);
+    }
+
+    if (!is_ok) {
+        out->is_failed = true;
+    }
+
+    uint64_t write_end = trace_begin();
+    pthread_mutex_unlock(&out->lock);
+
+    trace_span("wait", path, wait_start, write_start);
+    trace_span("write", path, write_start, write_end);
+}
+
+// swap staging and output dirs, then remove old output
+static bool out_publish(struct out *out) {
+    assert(out != NULL);
+
+    bool is_swapped = false;
+
+#if defined(__linux__) && defined(SYS_renameat2)
+    is_swapped = syscall(SYS_renameat2, AT_FDCWD, out->staging, AT_FDCWD,
+                         out->path, RENAME_EXCHANGE) == 0;
+#endif
+
+    if (is_swapped) {
+        // old output is in staging dir now
+        remove_at(AT_FDCWD, out->staging);
+        return true;
+    }
+
+    // no output yet or no exchange support, move old output aside first
+    char old_path[PATH_MAX];
+    snprintf(old_path, sizeof(old_path), "%s.old", out->staging);
+
+    bool has_old = rename(out->path, old_path) == 0;
+    if (!has_old && errno != ENOENT) {
+        PERROR("can't rename dir: %s", out->path);
+        remove_at(AT_FDCWD, out->staging);
+        return false;
+    }
+
+    if (rename(out->staging, out->path) == -1) {
+        PERROR("can't rename dir: %s", out->staging);
+        return false;
+    }
+
+    if (has_old) {
+        remove_at(AT_FDCWD, old_path);
+    }
+
+    return true;
+}
+
+static bool out_close(struct out *out) {
+    assert(out != NULL);
+
+    bool is_ok = !out->is_failed;
+
+    if (out->tar != NULL) {
+        is_ok = tar_finish(out->tar) && is_ok;
+        if (out->tar != stdout && fclose(out->tar) == EOF) {
+            PERROR("can't close file: %s", "tar");
+            is_ok = false;
+        }
+
+        out->tar = NULL;
+    }
+
+    if (out->stream != NULL) {
+        if (fflush(out->stream) == EOF) {
+            PERROR("can't write to stream: %s", "flush");
+            is_ok = false;
+        }
+
+        out->stream = NULL;
+    }
+
+    if (out->fd == -1) {
+        pthread_mutex_destroy(&out->lock);
+        return is_ok;
+    }
+
+    out_dirs_free(out);
+
+    if (*out->staging != '\0') {
+        // flush the whole staging dir at once before publishing
+#if defined(__linux__) && defined(SYS_syncfs)
+        if (syscall(SYS_syncfs, out->fd) == -1) {
+            PERROR("can't sync dir: %s", out->staging);
+            is_ok = false;
+        }
+#else
+        sync();
+#endif
+
+        // partial output never replaces the old one
+        if (is_ok) {
+            is_ok = out_publish(out);
+        } else {
+            fprintf(stderr, "output is not published: %s\n", out->path);
+            remove_at(AT_FDCWD, out->staging);
+        }
+
+        *out->staging = '\0';
+    }
+
+    close(out->fd);
+    out->fd = -1;
+    pthread_mutex_destroy(&out->lock);
+
+    return is_ok;
+}
+
+// symlinks are copied as files they point to
+static void out_copy_dir(struct out *out, char *dir_path, char *prefix) {
+    assert(out != NULL);
+    assert(dir_path != NULL);
+    assert(prefix != NULL);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", dir_path, prefix);
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        PERROR("can't open dir: %s", path);
+        return;
+    }
+
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0) {
+
+            continue;
+        }
+
+        // path relative to the copied dir, also stops symlink loops
+        char rel_path[PATH_MAX];
+        if (snprintf(rel_path, sizeof(rel_path), "%s/%s", prefix,
+                     entry->d_name) >= (int)sizeof(rel_path)) {
+
+            fprintf(stderr, "path is too long: %s%s\n", dir_path, prefix);
+            out->is_failed = true;
+            continue;
+        }
+
+        unsigned char type = dir_entry_type(dir, entry);
+        if (type == DT_DIR) {
+            out_copy_dir(out, dir_path, rel_path);
+        } else if (type == DT_REG) {
+            snprintf(path, sizeof(path), "%s%s", dir_path, rel_path);
+
+            size_t len = 0;
+            char *mem = file_alloc(path, &len);
+            if (mem == NULL) {
+                out->is_failed = true;
+                continue;
+            }
+
+            out_write(out, rel_path, mem, len);
+            free(mem);
+        }
+    }
+
+    closedir(dir);
+}
+
+/// Search
+
+// Words from page titles and content are collected while pages are generated
+// and written as a plain text inverted index, one line per record:
+//
+//     hcx-search 1
+//     <doc count>
+//     <url>\t<title>                                  for every doc
+//     <term count>
+//     <prefix len> <suffix> <doc> <doc delta> ...     for every term
+//
+// Terms are sorted and front coded: prefix len is the length of the prefix
+// shared with the previous term. Docs are numbered from zero. Docs are added
+// in page order before pages are rendered, docs of pages failed to render are
+// removed later and never written.
+
+#define SEARCH_VERSION 1
+#define SEARCH_TERM_MIN 2
+#define SEARCH_TERM_MAX 32
+#define SEARCH_DOC_NONE UINT32_MAX
+
+struct search_doc {
+    char *url;
+    char *title;
+    bool is_removed;
+};
+
+// posting list
+struct search_term {
+    uint32_t *docs; // ascending, without duplicates
+    size_t doc_count;
+};
+
+struct search {
+    struct search_doc *docs;
+    size_t doc_count;
+    struct map terms; // term -> struct search_term
+};
+
+// index path inside output dir, NULL if disabled
+static char *s_search_path = NULL;
+static struct search s_search;
+
+static void search_term_free(void *ptr) {
+    struct search_term *term = ptr;
+    free(term->docs);
+    free(term);
+}
+
+static void search_term_add(uint32_t doc, char *str, size_t len) {
+    assert(str != NULL);
+
+    struct search_term *term = map_find(&s_search.terms, str, len);
+    if (term == NULL) {
+        term = calloc(1, sizeof(*term));
+        map_put(&s_search.terms, str, len, term);
+    }
+
+    // docs are added one by one, so only the last one can repeat
+    if (term->doc_count > 0 && term->docs[term->doc_count - 1] == doc) {
+        return;
+    }
+
+    term->docs = array_grow(term->docs, term->doc_count, sizeof(*term->docs));
+    term->docs[term->doc_count] = doc;
+    ++term->doc_count;
+}
+
+// skip tag, contents of style and script tags are skipped too
+static char *search_tag_skip(char *str) {
+    assert(str != NULL);
+    assert(*str == '<');
+
+    char *end = strchr(str, '>');
+    if (end == NULL) {
+        return str + strlen(str);
+    }
+
+    char *closing = NULL;
+    if (strncasecmp(str, "<style", 6) == 0) {
+        closing = "</style";
+    } else if (strncasecmp(str, "<script", 7) == 0) {
+        closing = "</script";
+    }
+
+    if (closing != NULL) {
+        size_t closing_len = strlen(closing);
+        while ((end = strchr(end, '<')) != NULL &&
+               strncasecmp(end, closing, closing_len) != 0) {
+
+            ++end;
+        }
+
+        return end != NULL ? search_tag_skip(end) : str + strlen(str);
+    }
+
+    return end + 1;
+}
+
+// words are alphanumeric runs, non-ASCII bytes are part of words,
+// markup, placeholders and entities are skipped
+static void search_text_add(uint32_t doc, char *str) {
+    assert(str != NULL);
+
+    while (*str != '\0') {
+        unsigned char c = *str;
+
+        if (c == '<') {
+            str = search_tag_skip(str);
+            continue;
+        }
+
+        if (c == '{' && str[1] == '{') {
+            char *end = strstr(str, "}}");
+            str = end != NULL ? end + 2 : str + 2;
+            continue;
+        }
+
+        if (c == '&') {
+            size_t len = strspn(str + 1, "#abcdefghijklmnopqrstuvwxyz"
+                                         "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                         "0123456789");
+            str += str[len + 1] == ';' ? len + 2 : 1;
+            continue;
+        }
+
+        if (!isalnum(c) && c < 0x80) {
+            ++str;
+            continue;
+        }
+
+        char term[SEARCH_TERM_MAX];
+        size_t len = 0;
+        bool is_long = false;
+        for (; isalnum((unsigned char)*str) || (unsigned char)*str >= 0x80;
+             ++str) {
+
+            if (len < sizeof(term)) {
+                term[len] = (char)tolower((unsigned char)*str);
+                ++len;
+            } else {
+                is_long = true;
+            }
+        }
+
+        // too long words are truncated, but not in the middle of UTF-8 char
+        if (is_long && (unsigned char)term[len - 1] >= 0x80) {
+            while (len > 0 && ((unsigned char)term[len - 1] & 0xC0) == 0x80) {
+                --len;
+            }
+
+            if (len > 0 && (unsigned char)term[len - 1] >= 0xC0) {
+                --len;
+            }
+        }
+
+        if (len >= SEARCH_TERM_MIN) {
+            search_term_add(doc, term, len);
+        }
+    }
+}
+
+// page content must be loaded
+static uint32_t search_page_add(struct page *page) {
+    assert(page != NULL);
+    assert(page->url != NULL);
+
+    uint32_t doc = (uint32_t)s_search.doc_count;
+
+    struct search_doc search_doc = {0};
+    search_doc.url = page->url;
+    search_doc.title = page_conf(page, "title", "");
+
+    s_search.docs = array_grow(s_search.docs, s_search.doc_count,
+                               sizeof(*s_search.docs));
+    s_search.docs[doc] = search_doc;
+    ++s_search.doc_count;
+
+    search_text_add(doc, search_doc.title);
+
+    char *content = page_content(page, NULL);
+    if (content != NULL) {
+        search_text_add(doc, content);
+    }
+
+    return doc;
+}
+
+static void search_doc_remove(uint32_t doc) {
+    assert(doc < s_search.doc_count);
+
+    s_search.docs[doc].is_removed = true;
+}
+
+static int compare_map_entry_key(const void *a, const void *b) {
+    struct map_entry *entry_a = *(struct map_entry **)a;
+    struct map_entry *entry_b = *(struct map_entry **)b;
+    return strcmp(entry_a->key, entry_b->key);
+}
+
+// docs point into pages, so index must be written before pages are freed
+static char *search_alloc(size_t *len) {
+    assert(len != NULL);
+
+    char *str = NULL;
+    FILE *file = open_memstream(&str, len);
+    if (file == NULL) {
+        PERROR("can't allocate search index: %s", s_search_path);
+        return NULL;
+    }
+
+    // docs are numbered again without removed ones
+    uint32_t *ids = malloc((s_search.doc_count + 1) * sizeof(*ids));
+    uint32_t doc_count = 0;
+    for (size_t i = 0; i < s_search.doc_count; ++i) {
+        ids[i] = s_search.docs[i].is_removed ? SEARCH_DOC_NONE : doc_count++;
+    }
+
+    fprintf(file, "hcx-search %d\n%" PRIu32 "\n", SEARCH_VERSION, doc_count);
+    for (size_t i = 0; i < s_search.doc_count; ++i) {
+        struct search_doc *doc = &s_search.docs[i];
+        if (!doc->is_removed) {
+            fprintf(file, "%s\t%s\n", doc->url, doc->title);
+        }
+    }
+
+    // sort terms for front coding and binary search
+    struct map *terms = &s_search.terms;
+    struct map_entry **entries = malloc((terms->count + 1) * sizeof(*entries));
+    size_t entry_count = 0;
+    for (size_t i = 0; i < terms->cap; ++i) {
+        struct map_entry *entry = &terms->entries[i];
+        if (entry->key == NULL) {
+            continue;
+        }
+
+        // terms of removed docs only are skipped
+        struct search_term *term = entry->val;
+        for (size_t j = 0; j < term->doc_count; ++j) {
+            if (ids[term->docs[j]] != SEARCH_DOC_NONE) {
+                entries[entry_count] = entry;
+                ++entry_count;
+                break;
+            }
+        }
+    }
+
+    qsort(entries, entry_count, sizeof(*entries), compare_map_entry_key);
+
+    fprintf(file, "%zu\n", entry_count);
+    char *prev = "";
+    for (size_t i = 0; i < entry_count; ++i) {
+        char *key = entries[i]->key;
+        struct search_term *term = entries[i]->val;
+
+        size_t prefix = 0;
+        while (key[prefix] != '\0' && key[prefix] == prev[prefix]) {
+            ++prefix;
+        }
+
+        fprintf(file, "%zu %s", prefix, key + prefix);
+
+        uint32_t prev_doc = 0;
+        for (size_t j = 0; j < term->doc_count; ++j) {
+            uint32_t doc = ids[term->docs[j]];
+            if (doc != SEARCH_DOC_NONE) {
+                fprintf(file, " %" PRIu32, doc - prev_doc);
+                prev_doc = doc;
+            }
+        }
+
+        fputc('\n', file);
+        prev = key;
+    }
+
+    free(entries);
+    free(ids);
+
+    if (fclose(file) == EOF) {
+        PERROR("can't write search index: %s", s_search_path);
+        free(str);
+        return NULL;
+    }
+
+    return str;
+}
+
+static void search_write(struct out *out) {
+    assert(out != NULL);
+    assert(s_search_path != NULL);
+
+    size_t len = 0;
+    char *str = search_alloc(&len);
+    if (str == NULL) {
+        return;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/%s", s_search_path);
+    out_write(out, path, str, len);
+    free(str);
+}
+
+static void search_free(void) {
+    map_free(s_search.terms, search_term_free);
+    free(s_search.docs);
+    s_search = (struct search){0};
+}
+
+/// Shard
+
+// Pages are partitioned by FNV-1a hash of their path inside output dir, so
+// every builder picks the same pages. Every shard still reads the whole tree,
+// so blog, menu and inherited confs are resolved as in full builds. Merge
+// copies shard output dirs into output dir once every page is found in its
+// own shard and no file is found in several shards. Search index is built by
+// merge from content of written pages.
+
+static size_t s_shard_index = 0;
+static size_t s_shard_count = 1; // one shard means sharding is disabled
+
+static size_t shard_of(char *path, size_t shard_count) {
+    assert(path != NULL);
+    assert(shard_count > 0);
+
+    return hash_mem(path, strlen(path)) % shard_count;
+}
+
+static bool shard_has(struct page *page) {
+    assert(page != NULL);
+    assert(page->path != NULL);
+
+    return s_shard_count == 1 ||
+           shard_of(page->path, s_shard_count) == s_shard_index;
+}
+
+// "i/N", shards are numbered from zero
+static bool shard_parse(char *str, size_t *index, size_t *count) {
+    assert(str != NULL);
+    assert(index != NULL);
+    assert(count != NULL);
+
+    char *end = NULL;
+    if (!isdigit((unsigned char)*str)) {
+        return false;
+    }
+
+    unsigned long shard_index = strtoul(str, &end, 10);
+    if (*end != '/' || !isdigit((unsigned char)end[1])) {
+        return false;
+    }
+
+    unsigned long shard_count = strtoul(end + 1, &end, 10);
+    if (*end != '\0' || shard_index >= shard_count) {
+        return false;
+    }
+
+    *index = shard_index;
+    *count = shard_count;
+    return true;
+}
+
+struct shard_merge {
+    char **dirs; // shard output dirs in shard order
+    size_t dir_count;
+    struct map pages; // page path -> page
+    struct map files; // file path -> shard output dir
+    size_t error_count;
+};
+
+static void shard_merge_scan(struct shard_merge *merge, size_t shard,
+                             char *prefix) {
+    assert(merge != NULL);
+    assert(shard < merge->dir_count);
+    assert(prefix != NULL);
+
+    char *dir_path = merge->dirs[shard];
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", dir_path, prefix);
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        PERROR("can't open dir: %s", path);
+        ++merge->error_count;
+        return;
+    }
+
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0) {
+
+            continue;
+        }
+
+        // path relative to shard output dir
+        char rel_path[PATH_MAX];
+        snprintf(rel_path, sizeof(rel_path), "%s/%s", prefix, entry->d_name);
+        size_t rel_len = strlen(rel_path);
+
+        unsigned char type = dir_entry_type(dir, entry);
+        if (type == DT_DIR) {
+            shard_merge_scan(merge, shard, rel_path);
+            continue;
+        }
+
+        if (type != DT_REG) {
+            continue;
+        }
+
+        char *other_dir = map_find(&merge->files, rel_path, rel_len);
+        if (other_dir != NULL) {
+            fprintf(stderr, "file is in several shards: %s: %s, %s\n",
+                    rel_path, other_dir, dir_path);
+            ++merge->error_count;
+            continue;
+        }
+
+        map_put(&merge->files, rel_path, rel_len, dir_path);
+
+        // other files are static
+        struct page *page = map_find(&merge->pages, rel_path, rel_len);
+        if (page != NULL && shard_of(page->path, merge->dir_count) != shard) {
+            fprintf(stderr, "page is in wrong shard: %s: %s\n", dir_path,
+                    rel_path);
+            ++merge->error_count;
+        }
+    }
+
+    closedir(dir);
+}
+
+// pages with content are always generated
+static void shard_merge_check(struct shard_merge *merge, struct page *page) {
+    assert(merge != NULL);
+    assert(page != NULL);
+
+    bool has_content =
+        page_content(page, NULL) != NULL || page->conf.content_offset >= 0;
+    if (has_content &&
+        map_find(&merge->files, page->path, strlen(page->path)) == NULL) {
+
+        size_t shard = shard_of(page->path, merge->dir_count);
+        fprintf(stderr, "page is missing: %s: %s\n", merge->dirs[shard],
+                page->path);
+        ++merge->error_count;
+    }
+
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        shard_merge_check(merge, *child);
+    }
+}
+
+// docs keep page order as in full builds
+static void shard_merge_index(struct shard_merge *merge, struct page *page,
+                              char *in_path) {
+    assert(merge != NULL);
+    assert(page != NULL);
+    assert(in_path != NULL);
+
+    if (map_find(&merge->files, page->path, strlen(page->path)) != NULL) {
+        page_content_load(page, in_path);
+        search_page_add(page);
+        page_content_free(page);
+    }
+
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        shard_merge_index(merge, *child, in_path);
+    }
+}
+
+static void shard_merge_copy(struct shard_merge *merge, struct out *out) {
+    assert(merge != NULL);
+    assert(out != NULL);
+
+    for (size_t i = 0; i < merge->files.cap; ++i) {
+        struct map_entry *entry = &merge->files.entries[i];
+        if (entry->key == NULL) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s%s", (char *)entry->val, entry->key);
+
+        size_t len = 0;
+        char *mem = file_alloc(path, &len);
+        if (mem != NULL) {
+            out_write(out, entry->key, mem, len);
+            free(mem);
+        }
+    }
+}
+
+// nothing is written unless all shards are complete
+static bool shard_merge_run(char *in_path, char *out_path, char *tar_path,
+                            char *root_url, char **dirs, size_t dir_count) {
+    assert(in_path != NULL);
+    assert(out_path != NULL);
+    assert(root_url != NULL);
+    assert(dirs != NULL);
+
+    if (dir_count == 0) {
+        fprintf(stderr, "shard output dirs are missing\n");
+        return false;
+    }
+
+    struct page *tree = page_tree_alloc(in_path, "", false);
+    if (tree == NULL) {
+        return false;
+    }
+
+    page_urls_alloc(tree, root_url);
+    plugin_blog_sort(tree);
+
+    struct shard_merge merge = {0};
+    merge.dirs = dirs;
+    merge.dir_count = dir_count;
+    page_map_add(&merge.pages, tree);
+
+    for (size_t i = 0; i < dir_count; ++i) {
+        shard_merge_scan(&merge, i, "");
+    }
+
+    shard_merge_check(&merge, tree);
+
+    bool is_ok = merge.error_count == 0;
+    struct out out;
+    if (is_ok && out_open(&out, out_path, tar_path, true)) {
+        shard_merge_copy(&merge, &out);
+        if (s_search_path != NULL) {
+            shard_merge_index(&merge, tree, in_path);
+            search_write(&out);
+        }
+
+        is_ok = out_close(&out);
+        if (is_ok && s_manifest_path != NULL) {
+            manifest_write(root_url, true);
+        }
+    } else {
+        is_ok = false;
+    }
+
+    map_free(merge.pages, NULL);
+    map_free(merge.files, NULL);
+    page_free(tree);
+
+    return is_ok;
+}
+
+/// Links
+
+// Links are collected from generated pages and resolved in parallel once all
+// pages are generated. Internal links must point to a written page or to a
+// file inside static dir, external links are not checked. Pages of other
+// shards can't be written, so they only need content.
+
+struct link {
+    struct page *page; // page the link is found on
+    char *href;
+    size_t index; // pages are written in any order, links are sorted
+    bool is_broken;
+};
+
+struct links {
+    struct link *links;
+    size_t link_count;
+    struct map pages; // written page path -> page
+    char *static_path;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+static bool s_links_enabled = false;
+static struct links s_links;
+
+// collect href and src values of written page
+static void links_add(struct page *page, char *str) {
+    assert(page != NULL);
+    assert(str != NULL);
+
+    map_put(&s_links.pages, page->path, strlen(page->path), page);
+
+    char *attrs[] = {" href=", " src="};
+    for (size_t i = 0; i < ARRAY_LEN(attrs); ++i) {
+        size_t attr_len = strlen(attrs[i]);
+
+        char *match = str;
+        while ((match = strstr(match, attrs[i])) != NULL) {
+            match += attr_len;
+
+            char quote = *match;
+            if (quote != '"' && quote != '\'') {
+                continue;
+            }
+
+            ++match;
+            char *end = strchr(match, quote);
+            if (end == NULL) {
+                break;
+            }
+
+            struct link link = {0};
+            link.page = page;
+            link.href = strndup(match, end - match);
+            link.index = s_links.link_count;
+
+            s_links.links = array_grow(s_links.links, s_links.link_count,
+                                       sizeof(*s_links.links));
+            s_links.links[s_links.link_count] = link;
+            ++s_links.link_count;
+
+            match = end + 1;
+        }
+    }
+}
+
+// resolve "." and ".." segments, trailing slash is kept
+static void link_path_normalize(char *path, size_t size) {
+    assert(path != NULL);
+    assert(size > 0);
+
+    char norm[PATH_MAX] = "";
+    size_t len = 0;
+    bool is_dir = false;
+
+    char *seg = path;
+    while (seg != NULL) {
+        char *next = strchr(seg, '/');
+        size_t seg_len = next != NULL ? (size_t)(next - seg) : strlen(seg);
+
+        is_dir = seg_len == 0 || strncmp(seg, ".", seg_len) == 0 ||
+                 strncmp(seg, "..", seg_len) == 0;
+
+        if (seg_len == 2 && is_dir) {
+            // drop previous segment
+            while (len > 0 && norm[len - 1] != '/') {
+                --len;
+            }
+
+            len = len > 0 ? len - 1 : 0;
+            norm[len] = '\0';
+        } else if (!is_dir && len + seg_len + 1 < sizeof(norm)) {
+            norm[len] = '/';
+            memcpy(norm + len + 1, seg, seg_len);
+            len += seg_len + 1;
+            norm[len] = '\0';
+        }
+
+        seg = next != NULL ? next + 1 : NULL;
+    }
+
+    if (is_dir || len == 0) {
+        strcat_safe(norm, "/", sizeof(norm));
+    }
+
+    strcpy_safe(path, norm, size);
+}
+
+// path of internal link inside output dir, false for external links
+static bool link_path(struct link *link, char *path, size_t size) {
+    assert(link != NULL);
+    assert(path != NULL);
+    assert(size > 0);
+
+    char href[PATH_MAX];
+    strcpy_safe(href, link->href, sizeof(href));
+    href[strcspn(href, "?#")] = '\0';
+
+    // links to other sites and fragments on the same page,
+    // root url is the part of page url before page path
+    char *root_url = link->page->url;
+    size_t root_len = link->page->path - link->page->url;
+    char *rest = href;
+    if (root_len > 0 && strncmp(href, root_url, root_len) == 0) {
+        rest += root_len;
+    } else if (strncmp(href, "//", 2) == 0 ||
+               strcspn(href, ":") < strcspn(href, "/")) {
+
+        return false;
+    }
+
+    if (*rest == '\0' && rest == href) {
+        return false;
+    }
+
+    // relative links are relative to page dir
+    if (*rest == '/') {
+        strcpy_safe(path, rest, size);
+    } else {
+        strcpy_safe(path, link->page->path, size);
+        *(strrchr(path, '/') + 1) = '\0';
+        strcat_safe(path, rest, size);
+    }
+
+    link_path_normalize(path, size);
+    return true;
+}
+
+static bool link_valid(struct link *link) {
+    assert(link != NULL);
+
+    char path[PATH_MAX];
+    if (!link_path(link, path, sizeof(path))) {
+        return true;
+    }
+
+    if (page_map_find(&s_links.pages, path) != NULL) {
+        return true;
+    }
+
+    if (s_links.static_path == NULL) {
+        return false;
+    }
+
+    char static_path[PATH_MAX];
+    snprintf(static_path, sizeof(static_path), "%s%s", s_links.static_path,
+             path);
+
+    struct stat st;
+    return stat(static_path, &st) == 0;
+}
+
+static void *links_worker(void *arg) {
+    struct links *links = arg;
+    assert(links != NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&links->lock);
+        size_t i = links->next;
+        ++links->next;
+        pthread_mutex_unlock(&links->lock);
+
+        if (i >= links->link_count) {
+            return NULL;
+        }
+
+        struct link *link = &links->links[i];
+        link->is_broken = !link_valid(link);
+    }
+}
+
+// menu entries pointing to missing pages are rendered as "#"
+static size_t links_menu_check(struct page *page) {
+    assert(page != NULL);
+
+    size_t broken_count = 0;
+
+    struct page *menu = NULL;
+    for (size_t i = 0; i < page->special_count; ++i) {
+        if (strcmp(page->special[i]->name, ".menu.html") == 0) {
+            menu = page->special[i];
+        }
+    }
+
+    for (size_t i = 0; menu != NULL && i < menu->conf.pair_count; i += 2) {
+        char *page_path = conf_find(menu->conf, i, "page", NULL);
+        if (page_path != NULL && page_find(menu, page_path) == NULL) {
+            fprintf(stderr, "unresolved menu page: %s: %s\n", menu->path,
+                    page_path);
+            ++broken_count;
+        }
+    }
+
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        broken_count += links_menu_check(*child);
+    }
+
+    return broken_count;
+}
+
+// pages of other shards are written if they have content
+static void links_shard_pages_add(struct page *page, char *in_path) {
+    assert(page != NULL);
+    assert(in_path != NULL);
+
+    if (!shard_has(page)) {
+        page_load(page, in_path);
+        if (page->conf.content_offset >= 0) {
+            map_put(&s_links.pages, page->path, strlen(page->path), page);
+        }
+    }
+
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        links_shard_pages_add(*child, in_path);
+    }
+}
+
+static int compare_link(const void *a, const void *b) {
+    struct link *link_a = (struct link *)a;
+    struct link *link_b = (struct link *)b;
+
+    int cmp = strcmp(link_a->page->path, link_b->page->path);
+    if (cmp != 0) {
+        return cmp;
+    }
+
+    return (link_a->index > link_b->index) - (link_a->index < link_b->index);
+}
+
+// returns number of broken links
+static size_t links_check(struct page *tree, char *in_path,
+                          char *static_path) {
+    assert(tree != NULL);
+    assert(in_path != NULL);
+
+    s_links.static_path = static_path;
+    s_links.next = 0;
+    pthread_mutex_init(&s_links.lock, NULL);
+
+    if (s_shard_count > 1) {
+        links_shard_pages_add(tree, in_path);
+    }
+
+    threads_run(links_worker, &s_links);
+
+    pthread_mutex_destroy(&s_links.lock);
+
+    // report by page path, links of the same page in order
+    qsort(s_links.links, s_links.link_count, sizeof(*s_links.links),
+          compare_link);
+
+    size_t broken_count = 0;
+    for (size_t i = 0; i < s_links.link_count; ++i) {
+        struct link *link = &s_links.links[i];
+        if (link->is_broken) {
+            fprintf(stderr, "broken link: %s: %s\n", link->page->path,
+                    link->href);
+            ++broken_count;
+        }
+    }
+
+    return broken_count + links_menu_check(tree);
+}
+
+static void links_free(void) {
+    for (size_t i = 0; i < s_links.link_count; ++i) {
+        free(s_links.links[i].href);
+    }
+
+    free(s_links.links);
+    map_free(s_links.pages, NULL);
+    s_links = (struct links){0};
+}
+
+/// Generate
+
+// load only what page rendering needs: inherited confs, menu and blog
+static void generate_deps_load(struct page *page, char *in_path) {
+    assert(page != NULL);
+    assert(in_path != NULL);
+
+    for (struct page *parent = page; parent != NULL; parent = parent->parent) {
+        page_load(parent, in_path);
+    }
+
+    struct page *menu = page_find(page, ".menu.html");
+    if (menu != NULL) {
+        page_load(menu, in_path);
+    }
+
+    struct page *blog = page_find(page, PLUGIN_BLOG_PAGE);
+    if (blog != NULL) {
+        page_load(blog, in_path);
+        for (size_t i = 0; i < blog->child_count; ++i) {
+            struct page **post = &blog->children[i];
+            page_load(*post, in_path);
+        }
+    }
+}
+
+// feed is written together with blog index
+static void generate_feed(struct out *out, struct page *page, char *in_path) {
+    assert(out != NULL);
+    assert(page != NULL);
+    assert(in_path != NULL);
+
+    if (s_feed_count == 0 || !plugin_feed_is_blog(page)) {
+        return;
+    }
+
+    for (size_t i = 0; i < page->child_count && i < s_feed_count; ++i) {
+        page_load(page->children[i], in_path);
+    }
+
+    char url[PATH_MAX];
+    plugin_feed_url(page, url, sizeof(url));
+    char *path = url + (page->path - page->url);
+
+    struct scratch *scratch = scratch_thread();
+    size_t mark = scratch_mark(scratch);
+    char *str = plugin_feed_alloc(scratch, page, s_feed_count);
+    out_write(out, path, str, strlen(str));
+    scratch_release(scratch, mark);
+}
+
+static void generate_page(struct hc *hc, struct out *out, struct page *page,
+                          char *in_path) {
+    assert(hc != NULL);
+    assert(out != NULL);
+    assert(page != NULL);
+    assert(in_path != NULL);
+
+    if (!shard_has(page)) {
+        return;
+    }
+
+    generate_deps_load(page, in_path);
+    generate_feed(out, page, in_path);
+    page_content_load(page, in_path);
+
+    // write generated page
+    struct scratch *scratch = scratch_thread();
+    uint64_t trace_start = trace_begin();
+    char *str = plugin_base_alloc(hc, scratch, page);
+    trace_end("render", page->path, trace_start);
+    if (str != NULL) {
+        if (s_search_path != NULL) {
+            search_page_add(page);
+        }
+
+        out_write(out, page->path, str, strlen(str));
+        if (s_links_enabled) {
+            links_add(page, str);
+        }
+    }
+
+    scratch_reset(scratch);
+    page_content_free(page);
+}
+
+static void generate_pages(struct hc *hc, struct out *out, struct page *page,
+                           char *in_path) {
+    assert(page != NULL);
+
+    generate_page(hc, out, page, in_path);
+
+    // generate children
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        generate_pages(hc, out, *child, in_path);
+    }
+}
+
+// target is a page file or a subtree dir inside input dir,
+// optionally prefixed with input dir
+static bool generate_target(struct hc *hc, struct out *out, struct page *tree,
+                            char *in_path, char *target) {
+    assert(hc != NULL);
+    assert(out != NULL);
+    assert(tree != NULL);
+    assert(in_path != NULL);
+    assert(target != NULL);
+
+    size_t in_len = strlen(in_path);
+    if (strncmp(target, in_path, in_len) == 0 && target[in_len] == '/') {
+        target += in_len;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/%s", target);
+    page_md_name(path, sizeof(path));
+
+    // page index is the parent page itself, but without subtree
+    char *name = strrchr(path, '/') + 1;
+    bool is_index = strcmp(name, PAGE_INDEX) == 0;
+    if (is_index) {
+        *name = '\0';
+    }
+
+    struct page *page = page_find(tree, path);
+    if (page == NULL) {
+        fprintf(stderr, "page not found: %s\n", target);
+        return false;
+    }
+
+    if (is_index || !page->is_parent) {
+        generate_page(hc, out, page, in_path);
+    } else {
+        generate_pages(hc, out, page, in_path);
+    }
+
+    return true;
+}
+
+/// Pipeline
+
+// Full builds run in three stages connected by bounded queues: scanner loads
+// confs and content in tree order, workers render pages and writer writes
+// them, so reading, rendering and writing overlap. Stage waits while the next
+// queue is full, so only few pages are kept in memory. Page buffers are
+// returned by writer and reused by workers.
+
+#define PIPE_QUEUE_CAP 64
+
+struct pipe_item {
+    struct page *page;
+    struct buf *buf; // rendered page, NULL until rendered or if failed
+    uint32_t doc;    // search doc, SEARCH_DOC_NONE if none
+};
+
+struct pipe_queue {
+    struct pipe_item items[PIPE_QUEUE_CAP];
+    size_t head;
+    size_t count;
+    bool is_closed; // nothing is pushed anymore
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+struct pipe {
+    struct hc *hc;
+    struct out *out;
+    char *in_path;
+    struct pipe_queue render_queue;
+    struct pipe_queue write_queue;
+    struct buf **bufs; // free page buffers
+    size_t buf_count;
+    pthread_mutex_t buf_lock;
+    uint32_t *removed_docs; // docs of pages failed to render, see pipe_writer
+    size_t removed_doc_count;
+};
+
+static void pipe_queue_init(struct pipe_queue *queue) {
+    assert(queue != NULL);
+
+    queue->head = 0;
+    queue->count = 0;
+    queue->is_closed = false;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+}
+
+static void pipe_queue_destroy(struct pipe_queue *queue) {
+    assert(queue != NULL);
+
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+// wait while queue is full
+static void pipe_queue_push(struct pipe_queue *queue, struct pipe_item item) {
+    assert(queue != NULL);
+
+    pthread_mutex_lock(&queue->lock);
+    assert(!queue->is_closed);
+
+    while (queue->count == PIPE_QUEUE_CAP) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+
+    queue->items[(queue->head + queue->count) % PIPE_QUEUE_CAP] = item;
+    ++queue->count;
+
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// wait while queue is empty, false once queue is closed and drained
+static bool pipe_queue_pop(struct pipe_queue *queue, struct pipe_item *item) {
+    assert(queue != NULL);
+    assert(item != NULL);
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->count == 0 && !queue->is_closed) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+
+    bool has_item = queue->count > 0;
+    if (has_item) {
+        *item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % PIPE_QUEUE_CAP;
+        --queue->count;
+        pthread_cond_signal(&queue->not_full);
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return has_item;
+}
+
+static void pipe_queue_close(struct pipe_queue *queue) {
+    assert(queue != NULL);
+
+    pthread_mutex_lock(&queue->lock);
+    queue->is_closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static struct buf *pipe_buf_get(struct pipe *pipe) {
+    assert(pipe != NULL);
+
+    struct buf *buf = NULL;
+
+    pthread_mutex_lock(&pipe->buf_lock);
+    if (pipe->buf_count > 0) {
+        --pipe->buf_count;
+        buf = pipe->bufs[pipe->buf_count];
+    }
+    pthread_mutex_unlock(&pipe->buf_lock);
+
+    if (buf == NULL) {
+        buf = calloc(1, sizeof(*buf));
+        buf_realloc(buf, 1);
+    }
+
+    buf->len = 0;
+    *buf->buf = '\0';
+    return buf;
+}
+
+// same as scratch, large buffers aren't reused
+static void pipe_buf_put(struct pipe *pipe, struct buf *buf) {
+    assert(pipe != NULL);
+    assert(buf != NULL);
+
+    if (buf->cap > SCRATCH_BUF_KEEP) {
+        buf_free(*buf);
+        free(buf);
+        return;
+    }
+
+    pthread_mutex_lock(&pipe->buf_lock);
+    pipe->bufs =
+        array_grow(pipe->bufs, pipe->buf_count, sizeof(*pipe->bufs));
+    pipe->bufs[pipe->buf_count] = buf;
+    ++pipe->buf_count;
+    pthread_mutex_unlock(&pipe->buf_lock);
+}
+
+// confs are loaded only here, so workers only read loaded pages
+static void pipe_scan(struct pipe *pipe, struct page *page) {
+    assert(pipe != NULL);
+    assert(page != NULL);
+
+    if (shard_has(page)) {
+        uint64_t trace_start = trace_begin();
+        generate_deps_load(page, pipe->in_path);
+        page_content_load(page, pipe->in_path);
+        trace_end("load", page->path, trace_start);
+
+        generate_feed(pipe->out, page, pipe->in_path);
+
+        // index docs keep page order, pages without content aren't written
+        struct pipe_item item = {page, NULL, SEARCH_DOC_NONE};
+        if (s_search_path != NULL && page_content(page, NULL) != NULL) {
+            item.doc = search_page_add(page);
+        }
+
+        pipe_queue_push(&pipe->render_queue, item);
+    }
+
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        pipe_scan(pipe, *child);
+    }
+}
+
+static void *pipe_worker(void *arg) {
+    struct pipe *pipe = arg;
+    assert(pipe != NULL);
+
+    struct scratch *scratch = scratch_thread();
+
+    struct pipe_item item;
+    while (pipe_queue_pop(&pipe->render_queue, &item)) {
+        uint64_t trace_start = trace_begin();
+        char *str = plugin_base_alloc(pipe->hc, scratch, item.page);
+        trace_end("render", item.page->path, trace_start);
+
+        // page is copied, so scratch is ready for the next one
+        if (str != NULL) {
+            item.buf = pipe_buf_get(pipe);
+            buf_append(item.buf, str, strlen(str));
+        }
+
+        scratch_reset(scratch);
+        page_content_free(item.page);
+
+        // writer also removes docs of failed pages
+        if (item.buf != NULL || item.doc != SEARCH_DOC_NONE) {
+            pipe_queue_push(&pipe->write_queue, item);
+        }
+    }
+
+    return NULL;
+}
+
+static void *pipe_writer(void *arg) {
+    struct pipe *pipe = arg;
+    assert(pipe != NULL);
+
+    struct pipe_item item;
+    while (pipe_queue_pop(&pipe->write_queue, &item)) {
+        // docs can't be removed while scanner adds new ones
+        if (item.buf == NULL) {
+            pipe->removed_docs =
+                array_grow(pipe->removed_docs, pipe->removed_doc_count,
+                           sizeof(*pipe->removed_docs));
+            pipe->removed_docs[pipe->removed_doc_count] = item.doc;
+            ++pipe->removed_doc_count;
+            continue;
+        }
+
+        out_write(pipe->out, item.page->path, item.buf->buf, item.buf->len);
+        if (s_links_enabled) {
+            links_add(item.page, item.buf->buf);
+        }
+
+        pipe_buf_put(pipe, item.buf);
+    }
+
+    return NULL;
+}
+
+static void pipe_run(struct hc *hc, struct out *out, struct page *tree,
+                     char *in_path) {
+    assert(hc != NULL);
+    assert(out != NULL);
+    assert(tree != NULL);
+    assert(in_path != NULL);
+
+    struct pipe pipe = {0};
+    pipe.hc = hc;
+    pipe.out = out;
+    pipe.in_path = in_path;
+    pipe_queue_init(&pipe.render_queue);
+    pipe_queue_init(&pipe.write_queue);
+    pthread_mutex_init(&pipe.buf_lock, NULL);
+
+    pthread_t writer;
+    int err = pthread_create(&writer, NULL, pipe_writer, &pipe);
+    bool has_writer = err == 0;
+
+    size_t count = thread_count();
+    pthread_t *workers = malloc(count * sizeof(*workers));
+
+    size_t started = 0;
+    while (err == 0 && started < count) {
+        err = pthread_create(&workers[started], NULL, pipe_worker, &pipe);
+        started += err == 0;
+    }
+
+    if (err != 0) {
+        errno = err;
+        PERROR("can't create thread: %zu", started);
+    }
+
+    if (has_writer && started > 0) {
+        pipe_scan(&pipe, tree);
+    } else {
+        // full queue would block forever without threads
+        generate_pages(hc, out, tree, in_path);
+    }
+
+    // every stage drains its queue before the next one is closed
+    pipe_queue_close(&pipe.render_queue);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    pipe_queue_close(&pipe.write_queue);
+    if (has_writer) {
+        pthread_join(writer, NULL);
+    }
+
+    for (size_t i = 0; i < pipe.removed_doc_count; ++i) {
+        search_doc_remove(pipe.removed_docs[i]);
+    }
+
+    free(pipe.removed_docs);
+
+    for (size_t i = 0; i < pipe.buf_count; ++i) {
+        buf_free(*pipe.bufs[i]);
+        free(pipe.bufs[i]);
+    }
+
+    free(pipe.bufs);
+    free(workers);
+    pthread_mutex_destroy(&pipe.buf_lock);
+    pipe_queue_destroy(&pipe.render_queue);
+    pipe_queue_destroy(&pipe.write_queue);
+}
+
+/// Check
+
+// Every page is rendered in memory in parallel and nothing is written.
+// Problems are reported in page order once all pages are rendered: missing
+// templates, placeholders left in output, pages without title, unresolved
+// menu pages and front matter lines that aren't pairs.
+
+#define CHECK_PH_MAX 64
+
+struct check_page {
+    struct page *page;
+    bool is_rendered;      // pages without content aren't rendered
+    char ph[CHECK_PH_MAX]; // first placeholder left in output, if any
+};
+
+struct check {
+    struct hc *hc;
+    char *in_path;
+    struct check_page *pages;
+    size_t page_count;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+static void check_pages_add(struct check *check, struct page *page) {
+    assert(check != NULL);
+    assert(page != NULL);
+
+    struct check_page check_page = {page, false, ""};
+    check->pages =
+        array_grow(check->pages, check->page_count, sizeof(*check->pages));
+    check->pages[check->page_count] = check_page;
+    ++check->page_count;
+
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        check_pages_add(check, *child);
+    }
+}
+
+// placeholder is cut at the closing braces or at the line end
+static void check_ph_find(char *dst, size_t size, char *str) {
+    assert(dst != NULL);
+    assert(size > 0);
+    assert(str != NULL);
+
+    char *open = strstr(str, STRSUB_PH_OPEN);
+    if (open == NULL) {
+        *dst = '\0';
+        return;
+    }
+
+    size_t len = strcspn(open, "\n");
+    char *close = strstr(open, STRSUB_PH_CLOSE);
+    if (close != NULL && close < open + len) {
+        len = close + STRSUB_PH_CLOSE_LEN - open;
+    }
+
+    snprintf(dst, size, "%.*s", (int)len, open);
+}
+
+static void *check_worker(void *arg) {
+    struct check *check = arg;
+    assert(check != NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&check->lock);
+        size_t i = check->next;
+        ++check->next;
+        pthread_mutex_unlock(&check->lock);
+
+        if (i >= check->page_count) {
+            return NULL;
+        }
+
+        struct check_page *check_page = &check->pages[i];
+        struct page *page = check_page->page;
+        page_content_load(page, check->in_path);
+
+        struct scratch *scratch = scratch_thread();
+        char *str = plugin_base_alloc(check->hc, scratch, page);
+        check_page->is_rendered = str != NULL;
+        if (str != NULL) {
+            check_ph_find(check_page->ph, sizeof(check_page->ph), str);
+        }
+
+        scratch_reset(scratch);
+        page_content_free(page);
+    }
+}
+
+// templates are cached as NULL if they can't be loaded
+static size_t check_tpls(struct hc *hc) {
+    assert(hc != NULL);
+
+    struct map *tpls = &hc->tpls;
+    struct map_entry **entries = malloc((tpls->count + 1) * sizeof(*entries));
+    size_t entry_count = 0;
+    for (size_t i = 0; i < tpls->cap; ++i) {
+        struct map_entry *entry = &tpls->entries[i];
+        if (entry->key != NULL && ((struct tpl *)entry->val)->str == NULL) {
+            entries[entry_count] = entry;
+            ++entry_count;
+        }
+    }
+
+    qsort(entries, entry_count, sizeof(*entries), compare_map_entry_key);
+
+    for (size_t i = 0; i < entry_count; ++i) {
+        fprintf(stderr, "missing template: %s\n", entries[i]->key);
+    }
+
+    free(entries);
+    return entry_count;
+}
+
+static size_t check_page_conf(struct page *page) {
+    assert(page != NULL);
+
+    if (page->conf.skip_count == 0) {
+        return 0;
+    }
+
+    fprintf(stderr, "front matter lines skipped: %s: %zu\n", page->path,
+            page->conf.skip_count);
+    return 1;
+}
+
+static bool check_run(struct hc *hc, char *in_path, char *root_url) {
+    assert(hc != NULL);
+    assert(in_path != NULL);
+    assert(root_url != NULL);
+
+    struct page *tree = page_tree_alloc(in_path, "", false);
+    if (tree == NULL) {
+        return false;
+    }
+
+    page_urls_alloc(tree, root_url);
+    plugin_blog_sort(tree);
+
+    struct check check = {0};
+    check.hc = hc;
+    check.in_path = in_path;
+    check_pages_add(&check, tree);
+
+    pthread_mutex_init(&check.lock, NULL);
+    threads_run(check_worker, &check);
+    pthread_mutex_destroy(&check.lock);
+
+    size_t error_count = check_tpls(hc);
+    for (size_t i = 0; i < check.page_count; ++i) {
+        struct check_page *check_page = &check.pages[i];
+        struct page *page = check_page->page;
+
+        if (*check_page->ph != '\0') {
+            fprintf(stderr, "placeholder not substituted: %s: %s\n",
+                    page->path, check_page->ph);
+            ++error_count;
+        }
+
+        // home page title is site name
+        if (check_page->is_rendered && page->parent != NULL &&
+            page_conf(page, "title", NULL) == NULL) {
+
+            fprintf(stderr, "page has no title: %s\n", page->path);
+            ++error_count;
+        }
+
+        error_count += check_page_conf(page);
+        for (size_t j = 0; j < page->special_count; ++j) {
+            error_count += check_page_conf(page->special[j]);
+        }
+    }
+
+    error_count += links_menu_check(tree);
+
+    free(check.pages);
+    page_free(tree);
+
+    return error_count == 0;
+}
+
+/// Batch
+
+// Jobs file has a site per line: input dir, output dir and optional root url
+// separated by spaces. Sites share template and fragment caches, and pages of
+// all sites are generated together by one worker pool.
+
+struct site {
+    char in_path[PATH_MAX + 1];
+    char out_path[PATH_MAX + 1];
+    char root_url[PATH_MAX + 1];
+    struct page *tree;
+    struct out out;
+};
+
+struct batch_page {
+    struct site *site;
+    struct page *page;
+};
+
+struct batch {
+    struct hc *hc;
+    struct site *sites;
+    size_t site_count;
+    struct batch_page *pages;
+    size_t page_count;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+static bool batch_read(struct batch *batch, char *path) {
+    assert(batch != NULL);
+    assert(path != NULL);
+
+    char *str = file_alloc(path, NULL);
+    if (str == NULL) {
+        return false;
+    }
+
+    char *line = str;
+    while (*line != '\0') {
+        char *end = line + strcspn(line, "\n");
+        bool has_nl = *end == '\n';
+        *end = '\0';
+
+        struct site site = {0};
+        int count = sscanf(line, "%" STR(PATH_MAX) "s %" STR(PATH_MAX) "s %"
+                           STR(PATH_MAX) "s", site.in_path, site.out_path,
+                           site.root_url);
+
+        if (count < 1 || *site.in_path == '#') {
+            // skip empty lines and comments
+        } else if (count == 1) {
+            fprintf(stderr, "output dir is missing: %s\n", line);
+        } else {
+            batch->sites = array_grow(batch->sites, batch->site_count,
+                                      sizeof(*batch->sites));
+            batch->sites[batch->site_count] = site;
+            ++batch->site_count;
+        }
+
+        line = end + has_nl;
+    }
+
+    free(str);
+    return true;
+}
+
+static void batch_pages_add(struct batch *batch, struct site *site,
+                            struct page *page) {
+    assert(batch != NULL);
+    assert(site != NULL);
+    assert(page != NULL);
+
+    struct batch_page batch_page = {site, page};
+    batch->pages =
+        array_grow(batch->pages, batch->page_count, sizeof(*batch->pages));
+    batch->pages[batch->page_count] = batch_page;
+    ++batch->page_count;
+
+    for (size_t i = 0; i < page->child_count; ++i) {
+        struct page **child = &page->children[i];
+        batch_pages_add(batch, site, *child);
+    }
+}
+
+static void *batch_worker(void *arg) {
+    struct batch *batch = arg;
+    assert(batch != NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        size_t i = batch->next;
+        ++batch->next;
+        pthread_mutex_unlock(&batch->lock);
+
+        if (i >= batch->page_count) {
+            return NULL;
+        }
+
+        struct batch_page *page = &batch->pages[i];
+        generate_page(batch->hc, &page->site->out, page->page,
+                      page->site->in_path);
+    }
+}
+
+// trees are read completely first, so workers only read shared pages
+static bool batch_run(struct hc *hc, char *jobs_path) {
+    assert(hc != NULL);
+    assert(jobs_path != NULL);
+
+    struct batch batch = {0};
+    batch.hc = hc;
+    if (!batch_read(&batch, jobs_path)) {
+        return false;
+    }
+
+    bool is_ok = true;
+    for (size_t i = 0; i < batch.site_count; ++i) {
+        struct site *site = &batch.sites[i];
+
+        site->tree = page_tree_alloc(site->in_path, "", false);
+        if (site->tree == NULL) {
+            is_ok = false;
+            continue;
+        }
+
+        if (!out_open(&site->out, site->out_path, NULL, true)) {
+            page_free(site->tree);
+            site->tree = NULL;
+            is_ok = false;
+            continue;
+        }
+
+        page_urls_alloc(site->tree, site->root_url);
+        plugin_blog_sort(site->tree);
+        batch_pages_add(&batch, site, site->tree);
+    }
+
+    pthread_mutex_init(&batch.lock, NULL);
+    threads_run(batch_worker, &batch);
+    pthread_mutex_destroy(&batch.lock);
+
+    for (size_t i = 0; i < batch.site_count; ++i) {
+        struct site *site = &batch.sites[i];
+        if (site->tree == NULL) {
+            continue;
+        }
+
+        if (!out_close(&site->out)) {
+            is_ok = false;
+        }
+
+        page_free(site->tree);
+    }
+
+    free(batch.pages);
+    free(batch.sites);
+    return is_ok;
+}
+
+/// Library
+
+// content is loaded into a copy, so shared tree is never modified,
+// dependencies must be loaded already, page lives in scratch
+static char *page_render(struct hc *hc, struct scratch *scratch,
+                         struct page *page, char *in_path) {
+    assert(hc != NULL);
+    assert(scratch != NULL);
+    assert(page != NULL);
+    assert(in_path != NULL);
+
+    struct page copy = *page;
+    copy.conf.content = NULL;
+    copy.conf.content_buf = NULL;
+    page_content_load(&copy, in_path);
+
+    char *str = plugin_base_alloc(hc, scratch, &copy);
+    page_content_free(&copy);
+    return str;
+}
+
+struct hc *hc_alloc(char *tpl_path) {
+    assert(tpl_path != NULL);
+
+    struct hc *hc = calloc(1, sizeof(*hc));
+    strcpy_safe(hc->tpl_path, tpl_path, sizeof(hc->tpl_path));
+    pthread_rwlock_init(&hc->tpl_lock, NULL);
+    pthread_mutex_init(&hc->frag_lock, NULL);
+    return hc;
+}
+
+void hc_free(struct hc *hc) {
+    if (hc == NULL) {
+        return;
+    }
+
+    map_free(hc->tpls, tpl_free);
+    map_free(hc->frags, free);
+    pthread_rwlock_destroy(&hc->tpl_lock);
+    pthread_mutex_destroy(&hc->frag_lock);
+    free(hc);
+}
+
+void hc_preload(struct hc *hc) {
+    assert(hc != NULL);
+
+    tpl_preload(hc);
+}
+
+struct hc_site {
+    struct hc *hc;
+    char in_path[PATH_MAX];
+    struct page *tree;
+    struct map pages; // page path -> page
+};
+
+// the whole site is read at once, so pages can be rendered from any thread
+struct hc_site *hc_site_alloc(struct hc *hc, char *in_path, char *root_url) {
+    assert(hc != NULL);
+    assert(in_path != NULL);
+    assert(root_url != NULL);
+
+    struct page *tree = page_tree_alloc(in_path, "", false);
+    if (tree == NULL) {
+        return NULL;
+    }
+
+    page_urls_alloc(tree, root_url);
+    plugin_blog_sort(tree);
+
+    struct hc_site *site = calloc(1, sizeof(*site));
+    site->hc = hc;
+    strcpy_safe(site->in_path, in_path, sizeof(site->in_path));
+    site->tree = tree;
+    page_map_add(&site->pages, tree);
+    return site;
+}
+
+void hc_site_free(struct hc_site *site) {
+    if (site == NULL) {
+        return;
+    }
+
+    page_free(site->tree);
+    map_free(site->pages, NULL);
+    free(site);
+}
+
+// path is relative to output dir, dirs are resolved to page index
+struct hc_page *hc_page_find(struct hc_site *site, char *path) {
+    assert(site != NULL);
+    assert(path != NULL);
+
+    char page_path[PATH_MAX];
+    snprintf(page_path, sizeof(page_path), "%s%s", *path == '/' ? "" : "/",
+             path);
+
+    // pages are opaque outside
+    return (struct hc_page *)page_map_find(&site->pages, page_path);
+}
+
+// returns page length like snprintf does, -1 if page can't be rendered
+long hc_page_render(struct hc_site *site, struct hc_page *hc_page, char *buf,
+                    size_t size) {
+    assert(site != NULL);
+    assert(hc_page != NULL);
+    assert(buf != NULL || size == 0);
+
+    struct scratch *scratch = scratch_thread();
+    char *str = page_render(site->hc, scratch, (struct page *)hc_page,
+                            site->in_path);
+    if (str == NULL) {
+        scratch_reset(scratch);
+        return -1;
+    }
+
+    size_t len = strlen(str);
+    if (size > 0) {
+        size_t copy_len = len < size - 1 ? len : size - 1;
+        memcpy(buf, str, copy_len);
+        buf[copy_len] = '\0';
+    }
+
+    scratch_reset(scratch);
+    return (long)len;
+}
+
+/// Server
 
-struct page {
-    char name[NAME_MAX];
-    bool is_parent; // parent can have no children
-    struct conf conf;
-    struct page *parent;
-    struct page *children[PAGE_CHILDREN_MAX];
-    size_t child_count;
-    struct page *special[PAGE_SPECIAL_MAX];
-    size_t special_count;
+// Pages are rendered on request and kept in LRU cache bounded by size. Entry
+// is valid while sources of the page, its parents, menu, blog and blog posts
+// have the same mtimes as at render, changed confs are read again before
+// rendering. Tree structure and templates are read once, so new pages and
+// theme changes need restart.
+
+#define SRV_REQUEST_MAX 8192
+#define SRV_CACHE_MAX (64 * 1024 * 1024)
+#define SRV_TIMEOUT 5 // seconds
+#define SRV_STATS_PATH "/.stats" // special names are never pages
+#define SRV_HEADER_MAX 512
+
+static const long s_srv_buckets[] = {1000, 2000, 5000, 10000, 50000}; // us
+
+struct srv_entry {
+    char *path;
+    struct timespec *mtimes; // source mtime of every dependency at render
+    size_t mtime_count;
+    char *body; // NULL if evicted
+    size_t len;
+    char *gzip; // precompressed body, if any
+    size_t gzip_len;
+    struct srv_entry *prev; // more recently used
+    struct srv_entry *next; // less recently used
 };
 
-static struct page *page_alloc(char *name) {
-    assert(name != NULL);
+struct srv_stats {
+    uint64_t requests;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t not_found;
+    uint64_t errors;
+    uint64_t latency_sum; // us
+    uint64_t latency_max; // us
+    uint64_t buckets[ARRAY_LEN(s_srv_buckets) + 1];
+};
 
-    struct page *page = calloc(1, sizeof(*page));
-    strcpy_safe(page->name, name, sizeof(page->name));
-    return page;
+struct srv {
+    struct hc *hc;
+    char *in_path;
+    char *static_path;
+    struct page *tree;
+    struct map pages;           // page path -> page
+    pthread_rwlock_t tree_lock; // confs are read again when changed
+    int fd;
+    struct map entries; // page path -> entry, entries are never removed
+    struct srv_entry *head;
+    struct srv_entry *tail;
+    size_t cache_size;
+    size_t cache_max;
+    struct srv_stats stats;
+    pthread_mutex_t lock; // guards entries, list and stats
+};
+
+static void srv_entry_free(void *ptr) {
+    struct srv_entry *entry = ptr;
+    free(entry->path);
+    free(entry->mtimes);
+    free(entry->body);
+    free(entry->gzip);
+    free(entry);
 }
 
-static void page_free(struct page *page) {
-    if (page == NULL) {
-        return;
-    }
+static void srv_entry_unlink(struct srv *srv, struct srv_entry *entry) {
+    assert(srv != NULL);
+    assert(entry != NULL);
 
-    // free child pages
-    for (size_t i = 0; i < page->child_count; ++i) {
-        struct page **child = &page->children[i];
-        page_free(*child);
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else if (srv->head == entry) {
+        srv->head = entry->next;
     }
 
-    // free special pages
-    for (size_t i = 0; i < page->special_count; ++i) {
-        struct page **special = &page->special[i];
-        page_free(*special);
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else if (srv->tail == entry) {
+        srv->tail = entry->prev;
     }
 
-    conf_free(page->conf);
-    free(page);
+    entry->prev = NULL;
+    entry->next = NULL;
 }
 
-static bool page_add_special(struct page *page, struct page *special) {
-    assert(page != NULL);
+static void srv_entry_push(struct srv *srv, struct srv_entry *entry) {
+    assert(srv != NULL);
+    assert(entry != NULL);
 
-    if (page->special_count >= PAGE_SPECIAL_MAX) {
-        PERROR("too many special pages: %s", page->name);
-        return false;
+    entry->next = srv->head;
+    if (srv->head != NULL) {
+        srv->head->prev = entry;
     }
 
-    special->parent = page;
+    srv->head = entry;
+    if (srv->tail == NULL) {
+        srv->tail = entry;
+    }
+}
 
-    page->is_parent = true;
-    page->special[page->special_count] = special;
-    ++page->special_count;
+// entry stays in map without body, so it can be reused
+static void srv_entry_evict(struct srv *srv, struct srv_entry *entry) {
+    assert(srv != NULL);
+    assert(entry != NULL);
+
+    srv_entry_unlink(srv, entry);
+    srv->cache_size -= entry->len + entry->gzip_len;
+    free(entry->body);
+    free(entry->gzip);
+    entry->body = NULL;
+    entry->len = 0;
+    entry->gzip = NULL;
+    entry->gzip_len = 0;
+}
 
-    return true;
+static bool srv_stamp_equal(struct timespec a, struct timespec b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
 }
 
-static bool page_add(struct page *page, struct page *child) {
-    assert(page != NULL);
+// any change counts, mtimes can also move backwards (cp -p, rsync -t)
+static bool srv_entry_is_fresh(struct srv_entry *entry,
+                               struct timespec *mtimes, size_t mtime_count) {
+    assert(entry != NULL);
+    assert(mtimes != NULL);
 
-    if (child == NULL) {
+    if (entry->mtime_count != mtime_count) {
         return false;
     }
 
-    if (*child->name == PAGE_SPECIAL_PREFIX) {
-        return page_add_special(page, child);
+    for (size_t i = 0; i < mtime_count; ++i) {
+        if (!srv_stamp_equal(entry->mtimes[i], mtimes[i])) {
+            return false;
+        }
     }
 
-    if (page->child_count >= PAGE_CHILDREN_MAX) {
-        PERROR("too many children: %s", page->name);
-        return false;
-    }
+    return true;
+}
 
-    child->parent = page;
+// returns copy of cached body, NULL if page isn't cached or outdated,
+// is_gzip is reset if there is no compressed variant
+static char *srv_cache_get(struct srv *srv, char *path,
+                           struct timespec *mtimes, size_t mtime_count,
+                           bool *is_gzip, size_t *len) {
+    assert(srv != NULL);
+    assert(path != NULL);
+    assert(mtimes != NULL);
+    assert(is_gzip != NULL);
+    assert(len != NULL);
 
-    page->is_parent = true;
-    page->children[page->child_count] = child;
-    ++page->child_count;
+    char *mem = NULL;
 
-    return true;
+    pthread_mutex_lock(&srv->lock);
+    struct srv_entry *entry = map_find(&srv->entries, path, strlen(path));
+    if (entry != NULL && entry->body != NULL &&
+        srv_entry_is_fresh(entry, mtimes, mtime_count)) {
+
+        *is_gzip = *is_gzip && entry->gzip != NULL;
+        *len = *is_gzip ? entry->gzip_len : entry->len;
+        mem = malloc(*len + 1);
+        memcpy(mem, *is_gzip ? entry->gzip : entry->body, *len);
+        mem[*len] = '\0';
+
+        srv_entry_unlink(srv, entry);
+        srv_entry_push(srv, entry);
+    }
+
+    pthread_mutex_unlock(&srv->lock);
+    return mem;
 }
 
-// todo: not portable, whatever
-static struct page *page_tree_alloc(char *path, char *name) {
+// takes ownership of body and gzip, evicts least recently used pages
+static void srv_cache_put(struct srv *srv, char *path,
+                          struct timespec *mtimes, size_t mtime_count,
+                          char *body, size_t len, char *gzip,
+                          size_t gzip_len) {
+    assert(srv != NULL);
     assert(path != NULL);
-    assert(name != NULL);
+    assert(mtimes != NULL);
+    assert(body != NULL);
+
+    pthread_mutex_lock(&srv->lock);
+    struct srv_entry *entry = map_find(&srv->entries, path, strlen(path));
+    if (entry == NULL) {
+        entry = calloc(1, sizeof(*entry));
+        entry->path = strdup(path);
+        map_put(&srv->entries, path, strlen(path), entry);
+    } else if (entry->body != NULL) {
+        srv_entry_evict(srv, entry);
+    }
 
-    DIR *dir = opendir(path);
-    if (dir == NULL) {
-        PERROR("can't open dir: %s", path);
+    free(entry->mtimes);
+    entry->mtimes = malloc((mtime_count + 1) * sizeof(*entry->mtimes));
+    memcpy(entry->mtimes, mtimes, mtime_count * sizeof(*mtimes));
+    entry->mtime_count = mtime_count;
+    entry->body = body;
+    entry->len = len;
+    entry->gzip = gzip;
+    entry->gzip_len = gzip_len;
+    srv_entry_push(srv, entry);
+    srv->cache_size += len + gzip_len;
+
+    // keep at least the new page
+    while (srv->cache_size > srv->cache_max && srv->tail != entry) {
+        srv_entry_evict(srv, srv->tail);
+    }
+
+    pthread_mutex_unlock(&srv->lock);
+}
+
+#ifdef HC_ZLIB
+static char *srv_gzip_alloc(char *mem, size_t len, size_t *gzip_len) {
+    assert(mem != NULL);
+    assert(gzip_len != NULL);
+
+    z_stream stream = {0};
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
         return NULL;
     }
 
-    // allocate root page
-    struct page *page = page_alloc(name);
-    page->is_parent = true;
+    size_t size = deflateBound(&stream, len);
+    char *gzip = malloc(size);
+    stream.next_in = (Bytef *)mem;
+    stream.avail_in = len;
+    stream.next_out = (Bytef *)gzip;
+    stream.avail_out = size;
+
+    int err = deflate(&stream, Z_FINISH);
+    *gzip_len = stream.total_out;
+    deflateEnd(&stream);
+
+    // compressed variant is useless if it's not smaller
+    if (err != Z_STREAM_END || *gzip_len >= len) {
+        free(gzip);
+        *gzip_len = 0;
+        return NULL;
+    }
 
-    // allocate root conf
-    char conf_path[PATH_MAX];
-    snprintf(conf_path, sizeof(conf_path), "%s/" PAGE_INDEX, path);
-    page->conf = conf_alloc(conf_path);
+    return gzip;
+}
+#endif
 
-    struct dirent *entry = NULL;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_type == DT_DIR) {
-            // skip special directories
-            if (strcmp(entry->d_name, ".") == 0 ||
-                strcmp(entry->d_name, "..") == 0) {
+static void srv_stats_add(struct srv *srv, int status, bool is_hit,
+                          uint64_t latency) {
+    assert(srv != NULL);
+
+    pthread_mutex_lock(&srv->lock);
+    struct srv_stats *stats = &srv->stats;
+    ++stats->requests;
+    if (status == 404) {
+        ++stats->not_found;
+    } else if (status >= 400) {
+        ++stats->errors;
+    } else if (is_hit) {
+        ++stats->hits;
+    } else {
+        ++stats->misses;
+    }
 
-                continue;
-            }
+    stats->latency_sum += latency;
+    if (latency > stats->latency_max) {
+        stats->latency_max = latency;
+    }
 
-            // recursively read child directory
-            char dir_path[PATH_MAX];
-            snprintf(dir_path, sizeof(dir_path), "%s/%s", path, entry->d_name);
-            struct page *child = page_tree_alloc(dir_path, entry->d_name);
-            if (!page_add(page, child)) {
-                page_free(child);
-            }
-        } else if (entry->d_type == DT_REG) {
-            // skip page index
-            if (strcmp(entry->d_name, PAGE_INDEX) == 0) {
-                continue;
-            }
+    size_t bucket = 0;
+    while (bucket < ARRAY_LEN(s_srv_buckets) &&
+           latency > (uint64_t)s_srv_buckets[bucket]) {
+        ++bucket;
+    }
 
-            // allocate child page
-            struct page *child = page_alloc(entry->d_name);
-            if (page_add(page, child)) {
-                // allocate child conf
-                snprintf(conf_path, sizeof(conf_path), "%s/%s", path,
-                         entry->d_name);
-                child->conf = conf_alloc(conf_path);
-            } else {
-                page_free(child);
+    ++stats->buckets[bucket];
+    pthread_mutex_unlock(&srv->lock);
+}
+
+static char *srv_stats_alloc(struct srv *srv, size_t *len) {
+    assert(srv != NULL);
+    assert(len != NULL);
+
+    char *mem = NULL;
+    FILE *stream = open_memstream(&mem, len);
+
+    pthread_mutex_lock(&srv->lock);
+    struct srv_stats *stats = &srv->stats;
+    fprintf(stream, "requests %" PRIu64 "\n", stats->requests);
+    fprintf(stream, "hits %" PRIu64 "\n", stats->hits);
+    fprintf(stream, "misses %" PRIu64 "\n", stats->misses);
+    fprintf(stream, "not_found %" PRIu64 "\n", stats->not_found);
+    fprintf(stream, "errors %" PRIu64 "\n", stats->errors);
+    fprintf(stream, "cache_size %zu\n", srv->cache_size);
+    fprintf(stream, "latency_avg_us %" PRIu64 "\n",
+            stats->requests > 0 ? stats->latency_sum / stats->requests : 0);
+    fprintf(stream, "latency_max_us %" PRIu64 "\n", stats->latency_max);
+    for (size_t i = 0; i < ARRAY_LEN(s_srv_buckets); ++i) {
+        fprintf(stream, "latency_le_%ldus %" PRIu64 "\n", s_srv_buckets[i],
+                stats->buckets[i]);
+    }
+
+    fprintf(stream, "latency_gt_%ldus %" PRIu64 "\n",
+            s_srv_buckets[ARRAY_LEN(s_srv_buckets) - 1],
+            stats->buckets[ARRAY_LEN(s_srv_buckets)]);
+    pthread_mutex_unlock(&srv->lock);
+
+    fclose(stream);
+    return mem;
+}
+
+// strips query, decodes percent escapes, rejects paths leaving the site
+static bool srv_path_decode(char *path) {
+    assert(path != NULL);
+
+    if (*path != '/') {
+        return false;
+    }
+
+    path[strcspn(path, "?#")] = '\0';
+
+    char *dst = path;
+    for (char *src = path; *src != '\0'; ++src) {
+        unsigned int c = (unsigned char)*src;
+        if (c == '%') {
+            if (!isxdigit((unsigned char)src[1]) ||
+                !isxdigit((unsigned char)src[2]) ||
+                sscanf(src + 1, "%2x", &c) != 1 || c == '\0') {
+
+                return false;
             }
+
+            src += 2;
         }
+
+        *dst++ = (char)c;
     }
 
-    closedir(dir);
-    return page;
+    *dst = '\0';
+
+    for (char *dot = path; (dot = strstr(dot, "/..")) != NULL; ++dot) {
+        if (dot[3] == '/' || dot[3] == '\0') {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-static char *page_conf(struct page *page, char *key, char *val) {
-    assert(page != NULL);
-    assert(key != NULL);
+// returns header value, request must be NUL-terminated
+static char *srv_header_find(char *request, char *name, size_t *len) {
+    assert(request != NULL);
+    assert(name != NULL);
+    assert(len != NULL);
 
-    while (page != NULL) {
-        char *found = conf_find(page->conf, 0, key, NULL);
-        if (found != NULL) {
-            return found;
+    size_t name_len = strlen(name);
+    for (char *line = strstr(request, "\r\n"); line != NULL;
+         line = strstr(line, "\r\n")) {
+
+        line += 2;
+        if (strncasecmp(line, name, name_len) != 0 || line[name_len] != ':') {
+            continue;
         }
 
-        page = page->parent;
+        char *val = line + name_len + 1;
+        val += strspn(val, " \t");
+        *len = strcspn(val, "\r\n");
+        return val;
     }
 
-    return val;
+    return NULL;
 }
 
-static char *page_content(struct page *page, char *val) {
-    assert(page != NULL);
+static char *srv_content_type(char *path) {
+    assert(path != NULL);
 
-    struct conf conf = page->conf;
-    if (conf.content != NULL) {
-        return conf.content;
+    static char *types[][2] = {
+        {".html", "text/html; charset=utf-8"},
+        {".css", "text/css; charset=utf-8"},
+        {".js", "text/javascript; charset=utf-8"},
+        {".json", "application/json"},
+        {".txt", "text/plain; charset=utf-8"},
+        {".xml", "application/xml"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".webp", "image/webp"},
+        {".ico", "image/x-icon"},
+        {".woff2", "font/woff2"},
+    };
+
+    char *ext = strrchr(path, '.');
+    if (ext != NULL && strchr(ext, '/') == NULL) {
+        for (size_t i = 0; i < ARRAY_LEN(types); ++i) {
+            if (strcasecmp(ext, types[i][0]) == 0) {
+                return types[i][1];
+            }
+        }
     }
 
-    return val;
+    return "application/octet-stream";
 }
 
-static struct page *page_root(struct page *page) {
+static void srv_respond(int fd, int status, char *type, char *encoding,
+                        char *mem, size_t len, bool is_head) {
+    assert(type != NULL);
+
+    char *reason = status == 200   ? "OK"
+                   : status == 400 ? "Bad Request"
+                   : status == 404 ? "Not Found"
+                   : status == 405 ? "Method Not Allowed"
+                                   : "Internal Server Error";
+
+    char header[SRV_HEADER_MAX];
+    int header_len = snprintf(
+        header, sizeof(header),
+        "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+        "%s%s%sVary: Accept-Encoding\r\nConnection: close\r\n\r\n",
+        status, reason, type, len, encoding != NULL ? "Content-Encoding: " : "",
+        encoding != NULL ? encoding : "", encoding != NULL ? "\r\n" : "");
+
+    // client is gone, nothing to do
+    if (!fd_write(fd, header, header_len) || is_head || mem == NULL) {
+        return;
+    }
+
+    fd_write(fd, mem, len);
+}
+
+static void srv_error(int fd, int status) {
+    char mem[SRV_HEADER_MAX];
+    int len = snprintf(mem, sizeof(mem), "%d\n", status);
+    srv_respond(fd, status, "text/plain; charset=utf-8", NULL, mem, len,
+                false);
+}
+
+// rendering depends on page, its parents, menu, blog and blog posts confs,
+// the same deps as generate_deps_load reads
+struct srv_deps {
+    struct page **pages;
+    struct timespec *mtimes; // source mtimes before render
+    size_t count;
+};
+
+static void srv_deps_add(struct srv_deps *deps, struct page *page) {
+    assert(deps != NULL);
     assert(page != NULL);
 
-    if (page->parent == NULL) {
-        return page;
+    deps->pages = array_grow(deps->pages, deps->count, sizeof(*deps->pages));
+    deps->pages[deps->count] = page;
+    ++deps->count;
+}
+
+static void srv_deps_alloc(struct srv_deps *deps, struct page *page,
+                           char *in_path) {
+    assert(deps != NULL);
+    assert(page != NULL);
+    assert(in_path != NULL);
+
+    *deps = (struct srv_deps){0};
+    for (struct page *parent = page; parent != NULL; parent = parent->parent) {
+        srv_deps_add(deps, parent);
     }
 
-    return page_root(page->parent);
+    struct page *menu = page_find(page, ".menu.html");
+    if (menu != NULL) {
+        srv_deps_add(deps, menu);
+    }
+
+    struct page *blog = page_find(page, PLUGIN_BLOG_PAGE);
+    if (blog != NULL) {
+        srv_deps_add(deps, blog);
+        for (size_t i = 0; i < blog->child_count; ++i) {
+            srv_deps_add(deps, blog->children[i]);
+        }
+    }
+
+    deps->mtimes = malloc((deps->count + 1) * sizeof(*deps->mtimes));
+    for (size_t i = 0; i < deps->count; ++i) {
+        struct page *dep = deps->pages[i];
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s%s", in_path, dep->path);
+        page_src_name(dep, path, sizeof(path));
+
+        struct stat st;
+        deps->mtimes[i] =
+            stat(path, &st) == 0 ? st.ST_MTIM : (struct timespec){0};
+    }
 }
 
-static struct page *page_find(struct page *tree, char *path) {
-    assert(tree != NULL);
-    assert(path != NULL);
+static void srv_deps_free(struct srv_deps *deps) {
+    assert(deps != NULL);
 
-    // traverse from root if needed
-    if (*path == '/') {
-        struct page *root = page_root(tree);
-        return page_find(root, path + 1);
+    free(deps->pages);
+    free(deps->mtimes);
+}
+
+// returns rendered page, NULL on error, mtime checks are done without locks
+static char *srv_page_alloc(struct srv *srv, struct page *page, bool *is_gzip,
+                            size_t *len, bool *is_hit) {
+    assert(srv != NULL);
+    assert(page != NULL);
+    assert(is_gzip != NULL);
+    assert(len != NULL);
+    assert(is_hit != NULL);
+
+    struct srv_deps deps;
+    srv_deps_alloc(&deps, page, srv->in_path);
+
+    char *mem = srv_cache_get(srv, page->path, deps.mtimes, deps.count,
+                              is_gzip, len);
+    if (mem != NULL) {
+        srv_deps_free(&deps);
+        *is_hit = true;
+        return mem;
     }
 
-    // split path
-    char name[NAME_MAX + 1] = "";
-    char child_path[PATH_MAX + 1] = "";
-    sscanf(path, "%" STR(NAME_MAX) "[^/]/%" STR(PATH_MAX) "s", name,
-           child_path);
+    *is_hit = false;
 
-    switch (*name) {
-    case '\0':
-        // empty name, found it
-        return tree;
-    case '.':
-        if (name[1] != '\0') {
-            // not a dot name
-        } else if (!tree->is_parent && tree->parent != NULL) {
-            // start from parent if current page is not parent
-            return page_find(tree->parent, child_path);
-        } else {
-            // else just skip it
-            return page_find(tree, child_path);
-        }
-    default:
-        break;
+    // read changed confs again, other pages see them on next request
+    pthread_rwlock_rdlock(&srv->tree_lock);
+    bool is_stale = false;
+    for (size_t i = 0; i < deps.count && !is_stale; ++i) {
+        struct page *dep = deps.pages[i];
+        is_stale = !dep->is_loaded ||
+                   !srv_stamp_equal(dep->conf.mtime, deps.mtimes[i]);
     }
 
-    // find child page
-    for (size_t i = 0; i < tree->child_count; ++i) {
-        struct page **child = &tree->children[i];
-        if (strcmp((*child)->name, name) == 0) {
-            return page_find(*child, child_path);
+    pthread_rwlock_unlock(&srv->tree_lock);
+
+    if (is_stale) {
+        pthread_rwlock_wrlock(&srv->tree_lock);
+        for (size_t i = 0; i < deps.count; ++i) {
+            struct page *dep = deps.pages[i];
+            if (dep->is_loaded &&
+                !srv_stamp_equal(dep->conf.mtime, deps.mtimes[i])) {
+
+                conf_free(dep->conf);
+                dep->conf = (struct conf){0};
+                dep->is_loaded = false;
+            }
         }
-    }
 
-    // find special page
-    for (size_t i = 0; i < tree->special_count; ++i) {
-        struct page **special = &tree->special[i];
-        if (strcmp((*special)->name, name) == 0) {
-            return page_find(*special, child_path);
+        // fragments are keyed by blog and menu sources
+        struct page *frag_pages[] = {page_find(page, PLUGIN_BLOG_PAGE),
+                                     page_find(page, ".menu.html")};
+        for (size_t i = 0; i < ARRAY_LEN(frag_pages); ++i) {
+            if (frag_pages[i] != NULL) {
+                frag_page_key_free(srv->hc, frag_pages[i]);
+            }
         }
+
+        generate_deps_load(page, srv->in_path);
+        pthread_rwlock_unlock(&srv->tree_lock);
     }
 
-    // nothing found here, search in parent and so on
-    if (tree->parent != NULL) {
-        return page_find(tree->parent, path);
+    struct scratch *scratch = scratch_thread();
+    pthread_rwlock_rdlock(&srv->tree_lock);
+    char *str = page_render(srv->hc, scratch, page, srv->in_path);
+    pthread_rwlock_unlock(&srv->tree_lock);
+
+    if (str == NULL) {
+        scratch_reset(scratch);
+        srv_deps_free(&deps);
+        return NULL;
     }
 
-    return NULL;
+    size_t str_len = strlen(str);
+    char *gzip = NULL;
+    size_t gzip_len = 0;
+#ifdef HC_ZLIB
+    gzip = srv_gzip_alloc(str, str_len, &gzip_len);
+#endif
+
+    // cache and response both need own copy
+    *is_gzip = *is_gzip && gzip != NULL;
+    *len = *is_gzip ? gzip_len : str_len;
+    mem = malloc(*len + 1);
+    memcpy(mem, *is_gzip ? gzip : str, *len);
+    mem[*len] = '\0';
+
+    srv_cache_put(srv, page->path, deps.mtimes, deps.count, strdup(str),
+                  str_len, gzip, gzip_len);
+    scratch_reset(scratch);
+    srv_deps_free(&deps);
+    return mem;
 }
 
-static void page_path_append(struct page *page, char *path, size_t size) {
-    assert(page != NULL);
+// static files aren't cached, page cache keeps memory for pages
+static int srv_static(struct srv *srv, int fd, char *path, bool is_head) {
+    assert(srv != NULL);
     assert(path != NULL);
-    assert(size > 0);
 
-    // don't include root name
-    if (page->parent != NULL) {
-        page_path_append(page->parent, path, size);
-        strcat_safe(path, page->name, size);
+    if (srv->static_path == NULL) {
+        return 404;
     }
 
-    if (page->is_parent) {
-        strcat_safe(path, "/", size);
+    char file_path[PATH_MAX];
+    snprintf(file_path, sizeof(file_path), "%s%s", srv->static_path, path);
+
+    struct stat st;
+    if (stat(file_path, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return 404;
+    }
+
+    size_t len = 0;
+    char *mem = st.st_size > 0 ? file_alloc(file_path, &len) : strdup("");
+    if (mem == NULL) {
+        return 500;
     }
+
+    srv_respond(fd, 200, srv_content_type(path), NULL, mem, len, is_head);
+    free(mem);
+    return 200;
 }
 
-static void page_url_append(struct page *page, char *url, size_t size) {
-    assert(page != NULL);
-    assert(url != NULL);
+// reads headers only, body is never needed
+static void srv_read(int fd, char *request, size_t size) {
+    assert(request != NULL);
     assert(size > 0);
 
-    page_path_append(page, url, size);
-    if (page->is_parent) {
-        strcat_safe(url, PAGE_INDEX, size);
+    size_t len = 0;
+    request[len] = '\0';
+    while (len < size - 1) {
+        ssize_t n = read(fd, request + len, size - 1 - len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            break;
+        }
+
+        len += n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL) {
+            break;
+        }
     }
 }
 
-/// Templates
+static int srv_handle(struct srv *srv, int fd, char *request, bool *is_hit) {
+    assert(srv != NULL);
+    assert(request != NULL);
+    assert(is_hit != NULL);
 
-#define TPL_MAX 128
+    char method[8] = "";
+    char path[PATH_MAX + 1] = "";
+    if (sscanf(request, "%7s %" STR(PATH_MAX) "s HTTP/", method, path) != 2) {
+        srv_error(fd, 400);
+        return 400;
+    }
 
-struct tpl {
-    char path[PATH_MAX];
-    char *str;
-};
+    bool is_head = strcmp(method, "HEAD") == 0;
+    if (!is_head && strcmp(method, "GET") != 0) {
+        srv_error(fd, 405);
+        return 405;
+    }
 
-// templates are cached globally
-char *s_tpl_path = "theme";
-struct tpl s_tpls[TPL_MAX];
-size_t s_tpl_count;
+    if (!srv_path_decode(path)) {
+        srv_error(fd, 400);
+        return 400;
+    }
 
-static char *tpl_cached(char *path) {
-    assert(path != NULL);
+    if (strcmp(path, SRV_STATS_PATH) == 0) {
+        size_t len = 0;
+        char *mem = srv_stats_alloc(srv, &len);
+        srv_respond(fd, 200, "text/plain; charset=utf-8", NULL, mem, len,
+                    is_head);
+        free(mem);
+        return 200;
+    }
 
-    // find cached template
-    for (size_t i = 0; i < s_tpl_count; ++i) {
-        struct tpl *tpl = &s_tpls[i];
-        if (strcmp(tpl->path, path) == 0) {
-            return tpl->str;
+    struct page *page = page_map_find(&srv->pages, path);
+    if (page == NULL) {
+        int status = srv_static(srv, fd, path, is_head);
+        if (status != 200) {
+            srv_error(fd, status);
         }
-    }
 
-    if (s_tpl_count >= TPL_MAX) {
-        PERROR("too many templates: %s", path);
-        return NULL;
+        return status;
     }
 
-    // load new template and cache it (even if NULL)
-    char full_path[PATH_MAX];
-    snprintf(full_path, sizeof(full_path), "%s/%s", s_tpl_path, path);
-    char *str = file_alloc(full_path);
-
-    struct tpl tpl = {0};
-    strcpy_safe(tpl.path, path, sizeof(tpl.path));
-    tpl.str = str;
+    // compressed variant exists only if built with zlib
+    bool is_gzip = false;
+    size_t encoding_len = 0;
+    char *encoding = srv_header_find(request, "Accept-Encoding", &encoding_len);
+    if (encoding != NULL) {
+        char accept[SRV_HEADER_MAX];
+        snprintf(accept, sizeof(accept), "%.*s", (int)encoding_len, encoding);
+        is_gzip = strstr(accept, "gzip") != NULL;
+    }
 
-    s_tpls[s_tpl_count] = tpl;
-    ++s_tpl_count;
+    size_t len = 0;
+    // pages without content aren't generated
+    char *mem = srv_page_alloc(srv, page, &is_gzip, &len, is_hit);
+    if (mem == NULL) {
+        srv_error(fd, 404);
+        return 404;
+    }
 
-    return str;
+    srv_respond(fd, 200, "text/html; charset=utf-8", is_gzip ? "gzip" : NULL,
+                mem, len, is_head);
+    free(mem);
+    return 200;
 }
 
-static void tpl_cache_free(void) {
-    for (size_t i = 0; i < s_tpl_count; ++i) {
-        struct tpl *tpl = &s_tpls[i];
-        free(tpl->str);
-    }
+static uint64_t srv_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
-/// Plugins
+static void *srv_worker(void *arg) {
+    struct srv *srv = arg;
 
-char *s_root_url = "";
+    struct timeval timeout = {.tv_sec = SRV_TIMEOUT};
+    while (true) {
+        int fd = accept(srv->fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                PERROR("can't accept connection: %d", srv->fd);
+            }
 
-/// Blog plugin
+            continue;
+        }
 
-#define PLUGIN_BLOG_DATE_FORMAT "YYYY-mm-dd"
-#define PLUGIN_BLOG_DATE_LEN sizeof(PLUGIN_BLOG_DATE_FORMAT)
-#define PLUGIN_BLOG_PAGE "blog"
+        // slow clients can't hold a worker forever
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
 
-static int compare_page_name(const void *a, const void *b) {
-    assert(a != NULL);
-    assert(b != NULL);
+        char request[SRV_REQUEST_MAX];
+        srv_read(fd, request, sizeof(request));
 
-    struct page *page1 = *(struct page **)a;
-    struct page *page2 = *(struct page **)b;
-    assert(page1 != NULL);
-    assert(page2 != NULL);
+        // latency doesn't include waiting for slow clients
+        uint64_t start = srv_now();
+        bool is_hit = false;
+        int status = srv_handle(srv, fd, request, &is_hit);
+        srv_stats_add(srv, status, is_hit, srv_now() - start);
 
-    return strcmp(page2->name, page1->name);
+        close(fd);
+    }
+
+    return NULL;
 }
 
-static char *plugin_blog_list_alloc(struct page *page) {
-    assert(page != NULL);
+// address is host:port, host can be empty or [ipv6]
+static int srv_listen(char *addr) {
+    assert(addr != NULL);
 
-    struct page *blog = page_find(page, PLUGIN_BLOG_PAGE);
-    if (blog == NULL) {
-        return NULL;
+    char host[NAME_MAX] = "";
+    char *port = strrchr(addr, ':');
+    if (port == NULL) {
+        fprintf(stderr, "invalid address: %s\n", addr);
+        return -1;
     }
 
-    char *tpl = tpl_cached("blog/list.html");
-    if (tpl == NULL) {
-        return NULL;
+    size_t host_len = port - addr;
+    if (host_len >= 2 && addr[0] == '[' && addr[host_len - 1] == ']') {
+        ++addr;
+        host_len -= 2;
     }
 
-    // sort children by date (which is really just a name)
-    qsort(blog->children, blog->child_count, sizeof(*blog->children),
-          compare_page_name);
+    snprintf(host, sizeof(host), "%.*s", (int)host_len, addr);
+    ++port;
 
-    struct buf buf = {0};
-    for (size_t i = 0; i < blog->child_count; ++i) {
-        struct page **post = &blog->children[i];
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
 
-        char *title = page_conf(*post, "title", NULL);
+    struct addrinfo *infos = NULL;
+    int err = getaddrinfo(*host != '\0' ? host : NULL, port, &hints, &infos);
+    if (err != 0) {
+        fprintf(stderr, "invalid address: %s: %s\n", addr, gai_strerror(err));
+        return -1;
+    }
 
-        char date[PLUGIN_BLOG_DATE_LEN] = "";
-        strcat_safe(date, (*post)->name, sizeof(date));
+    int fd = -1;
+    for (struct addrinfo *info = infos; info != NULL; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
 
-        char url[PATH_MAX] = "";
-        strcat_safe(url, s_root_url, sizeof(url));
-        page_url_append(*post, url, sizeof(url));
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, info->ai_addr, info->ai_addrlen) == 0 &&
+            listen(fd, SOMAXCONN) == 0) {
 
-        struct strsub_pair pairs[] = {
-            {"{{ title }}", title}, //
-            {"{{ date }}", date},   //
-            {"{{ url }}", url},     //
-        };
+            break;
+        }
 
-        char *replaced = strsub_alloc(tpl, pairs, ARRAY_LEN(pairs));
-        buf_realloc(&buf, buf.len + strlen(replaced));
-        strcat(buf.buf, replaced);
-        free(replaced);
+        close(fd);
+        fd = -1;
     }
 
-    return buf.buf;
+    if (fd == -1) {
+        PERROR("can't listen: %s", port);
+    }
+
+    freeaddrinfo(infos);
+    return fd;
 }
 
-static char *plugin_blog_post_alloc(struct page *page) {
-    assert(page != NULL);
+static void srv_free(struct srv *srv) {
+    assert(srv != NULL);
 
-    char *tpl = tpl_cached("blog/post.html");
-    if (tpl == NULL) {
-        return NULL;
+    map_free(srv->pages, NULL);
+    map_free(srv->entries, srv_entry_free);
+    pthread_rwlock_destroy(&srv->tree_lock);
+    pthread_mutex_destroy(&srv->lock);
+}
+
+// reads only tree structure, confs are read on first request of the page,
+// runs until killed
+static bool srv_run(struct hc *hc, char *addr, char *in_path, char *root_url,
+                    char *static_path) {
+    assert(hc != NULL);
+    assert(addr != NULL);
+    assert(in_path != NULL);
+    assert(root_url != NULL);
+
+    struct srv srv = {0};
+    srv.hc = hc;
+    srv.in_path = in_path;
+    srv.static_path = static_path;
+    srv.cache_max = SRV_CACHE_MAX;
+    pthread_rwlock_init(&srv.tree_lock, NULL);
+    pthread_mutex_init(&srv.lock, NULL);
+
+    srv.tree = page_tree_alloc(in_path, "", true);
+    if (srv.tree == NULL) {
+        srv_free(&srv);
+        return false;
     }
 
-    char *content = page_content(page, NULL);
-    if (content == NULL) {
-        return NULL;
+    page_urls_alloc(srv.tree, root_url);
+    plugin_blog_sort(srv.tree);
+    page_map_add(&srv.pages, srv.tree);
+
+    srv.fd = srv_listen(addr);
+    if (srv.fd == -1) {
+        page_free(srv.tree);
+        srv_free(&srv);
+        return false;
     }
 
-    char *title = page_conf(page, "title", NULL);
+    // closed connections must not kill the server
+    signal(SIGPIPE, SIG_IGN);
 
-    char date[PLUGIN_BLOG_DATE_LEN] = "";
-    strcat_safe(date, page->name, sizeof(date));
+    printf("listening on %s\n", addr);
+    fflush(stdout);
+    threads_run(srv_worker, &srv);
 
-    struct strsub_pair pairs[] = {
-        {"{{ content }}", content}, //
-        {"{{ title }}", title},     //
-        {"{{ date }}", date},       //
-    };
+    close(srv.fd);
+    page_free(srv.tree);
+    srv_free(&srv);
+    return true;
+}
+
+#if defined(HC_EMBED)
 
-    return strsub_alloc(tpl, pairs, ARRAY_LEN(pairs));
+/// Embed
+
+// Templates of the theme are written by the build as C source, which is
+// included by main.c, see make THEME=path. Segments point into template
+// bytes, so nothing is parsed on startup.
+
+#define EMBED_BYTES_PER_LINE 9
+
+static int compare_str(const void *a, const void *b) {
+    return strcmp(*(char **)a, *(char **)b);
 }
 
-/// Page plugin
+static void embed_path_write(FILE *out, char *path) {
+    assert(out != NULL);
+    assert(path != NULL);
 
-static char *plugin_page_alloc(struct page *page) {
-    assert(page != NULL);
+    fputc('"', out);
+    for (char *c = path; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\' || *c == '?' ||
+            !isprint((unsigned char)*c)) {
 
-    char *tpl = tpl_cached("page.html");
-    if (tpl == NULL) {
-        return NULL;
+            fprintf(out, "\\%03o", (unsigned char)*c);
+        } else {
+            fputc(*c, out);
+        }
     }
 
-    char *content = page_content(page, NULL);
-    if (content == NULL) {
-        return NULL;
+    fputc('"', out);
+}
+
+static void embed_tpl_write(FILE *out, struct tpl *tpl, size_t index) {
+    assert(out != NULL);
+    assert(tpl != NULL);
+    assert(tpl->str != NULL);
+
+    // char list instead of string literal, which has length limit
+    size_t len = strlen(tpl->str);
+    fprintf(out, "static char s_tpl_embed_str_%zu[] = {", index);
+    for (size_t i = 0; i <= len; ++i) {
+        fputs(i % EMBED_BYTES_PER_LINE == 0 ? "\n    " : " ", out);
+        fprintf(out, "'\\x%02x',", (unsigned char)tpl->str[i]);
     }
 
-    char *title = page_conf(page, "title", NULL);
-    struct strsub_pair pairs[] = {
-        {"{{ content }}", content}, //
-        {"{{ title }}", title},     //
-    };
+    fprintf(out, "\n};\n\n");
 
-    return strsub_alloc(tpl, pairs, ARRAY_LEN(pairs));
+    fprintf(out, "static struct tpl_seg s_tpl_embed_segs_%zu[] = {\n", index);
+    for (size_t i = 0; i < tpl->seg_count; ++i) {
+        struct tpl_seg *seg = &tpl->segs[i];
+        fprintf(out, "    {s_tpl_embed_str_%zu + %td, %zu, ", index,
+                seg->text - tpl->str, seg->text_len);
+        if (seg->ph != NULL) {
+            fprintf(out, "s_tpl_embed_str_%zu + %td, %zu},\n", index,
+                    seg->ph - tpl->str, seg->ph_len);
+        } else {
+            fprintf(out, "NULL, 0},\n");
+        }
+    }
+
+    fprintf(out, "};\n\n");
 }
 
-/// Menu plugin
+static bool embed_write(FILE *out, char *tpl_path) {
+    assert(out != NULL);
+    assert(tpl_path != NULL);
 
-static char *plugin_menu_alloc(struct page *page) {
-    assert(page != NULL);
+    struct hc *hc = hc_alloc(tpl_path);
+    struct tpl_preload preload = {0};
+    preload.hc = hc;
+    tpl_preload_add(&preload, "");
 
-    struct page *menu = page_find(page, ".menu.html");
-    if (menu == NULL) {
-        return NULL;
+    // same source for the same theme
+    qsort(preload.paths, preload.path_count, sizeof(*preload.paths),
+          compare_str);
+
+    bool is_ok = preload.path_count > 0;
+    if (!is_ok) {
+        fprintf(stderr, "no templates: %s\n", tpl_path);
     }
 
-    char *tpl = tpl_cached("menu.html");
-    if (tpl == NULL) {
-        return NULL;
+    fprintf(out, "// Generated from %s, don't edit\n\n", tpl_path);
+    for (size_t i = 0; i < preload.path_count && is_ok; ++i) {
+        struct tpl *tpl = tpl_cached(hc, preload.paths[i]);
+        if (tpl == NULL) {
+            is_ok = false;
+            break;
+        }
+
+        embed_tpl_write(out, tpl, i);
     }
 
-    struct buf buf = {0};
-    for (size_t i = 0; i < menu->conf.pair_count; i += 2) {
-        char *title = conf_find(menu->conf, i, "title", NULL);
-        char *page_url = conf_find(menu->conf, i, "url", NULL);
-        char *page_path = conf_find(menu->conf, i, "page", NULL);
+    fprintf(out, "static struct tpl_embed s_tpl_embeds[] = {\n");
+    for (size_t i = 0; i < preload.path_count && is_ok; ++i) {
+        fprintf(out, "    {");
+        embed_path_write(out, preload.paths[i]);
+        fprintf(out, ", s_tpl_embed_str_%zu, s_tpl_embed_segs_%zu,\n", i, i);
+        fprintf(out, "     ARRAY_LEN(s_tpl_embed_segs_%zu)},\n", i);
+    }
 
-        char url[PATH_MAX] = "#";
-        if (page_path != NULL) {
-            struct page *target_page = page_find(menu, page_path);
-            if (target_page != NULL) {
-                strcpy_safe(url, s_root_url, sizeof(url));
-                page_url_append(target_page, url, sizeof(url));
-            }
-        } else if (page_url != NULL) {
-            strcpy_safe(url, page_url, sizeof(url));
-        }
+    fprintf(out, "};\n");
 
-        struct strsub_pair pairs[] = {
-            {"{{ title }}", title}, //
-            {"{{ url }}", url},     //
-        };
+    for (size_t i = 0; i < preload.path_count; ++i) {
+        free(preload.paths[i]);
+    }
+
+    free(preload.paths);
+    hc_free(hc);
+    return is_ok && !ferror(out);
+}
 
-        char *replaced = strsub_alloc(tpl, pairs, ARRAY_LEN(pairs));
-        buf_realloc(&buf, buf.len + strlen(replaced));
-        strcat(buf.buf, replaced);
-        free(replaced);
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s theme dir\n", argv[0]);
+        return EXIT_FAILURE;
     }
 
-    return buf.buf;
+    return embed_write(stdout, argv[1]) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-/// Home plugin
+#elif !defined(TEST) && !defined(HC_LIB)
 
-static char *plugin_home_alloc(struct page *page) {
-    assert(page != NULL);
+/// EP
 
-    char *tpl = tpl_cached("home.html");
-    if (tpl == NULL) {
-        return NULL;
-    }
+// long options without short ones
+enum {
+    OPT_SHARD = 256,
+    OPT_MERGE,
+    OPT_TRACE,
+    OPT_CHECK,
+};
 
-    char *content = page_content(page, NULL);
-    struct strsub_pair pairs[] = {
-        {"{{ content }}", content}, //
+int main(int argc, char *argv[]) {
+    char *in_path = "content";
+    char *out_path = "public";
+#ifdef HC_THEME
+    char *tpl_path = ""; // embedded theme
+#else
+    char *tpl_path = "theme";
+#endif
+    char *root_url = "";
+    char *cache_path = NULL;
+    char *tar_path = NULL;
+    char *static_path = NULL;
+    char *jobs_path = NULL;
+    char *srv_addr = NULL;
+    bool preload = false;
+    bool is_merge = false;
+    char *trace_path = NULL;
+    bool is_check = false;
+
+    struct option options[] = {
+        {"shard", required_argument, NULL, OPT_SHARD},
+        {"merge", no_argument, NULL, OPT_MERGE},
+        {"trace", required_argument, NULL, OPT_TRACE},
+        {"check", no_argument, NULL, OPT_CHECK},
+        {NULL, 0, NULL, 0},
     };
 
-    return strsub_alloc(tpl, pairs, ARRAY_LEN(pairs));
-}
+    int opt;
+    char *short_options = "i:o:t:r:c:a:s:x:m:b:S:f:lPv";
+    while ((opt = getopt_long(argc, argv, short_options, options, NULL)) !=
+           -1) {
 
-/// Base plugin
+        switch (opt) {
+        case 'i':
+            in_path = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 't':
+            tpl_path = optarg;
+            break;
+        case 'r':
+            root_url = optarg;
+            break;
+        case 'c':
+            cache_path = optarg;
+            break;
+        case 'a':
+            tar_path = optarg;
+            break;
+        case 's':
+            static_path = optarg;
+            break;
+        case 'x':
+            s_search_path = optarg;
+            break;
+        case 'm':
+            s_manifest_path = optarg;
+            break;
+        case 'b':
+            jobs_path = optarg;
+            break;
+        case 'S':
+            srv_addr = optarg;
+            break;
+        case 'f': {
+            // strtoul accepts sign and leading spaces
+            char *end = NULL;
+            if (isdigit((unsigned char)*optarg)) {
+                s_feed_count = strtoul(optarg, &end, 10);
+            }
 
-#define PLUGIN_BASE_TITLE_MAX 128
+            if (end != NULL && *end == '\0') {
+                break;
+            }
 
-static char *plugin_base_alloc(struct page *page) {
-    assert(page != NULL);
+            fprintf(stderr, "invalid feed post count: %s\n", optarg);
+            return EXIT_FAILURE;
+        }
+        case 'l':
+            s_links_enabled = true;
+            break;
+        case 'P':
+            preload = true;
+            break;
+        case 'v':
+            puts("version " STR(VERSION));
+            return EXIT_SUCCESS;
+        case OPT_SHARD:
+            if (shard_parse(optarg, &s_shard_index, &s_shard_count)) {
+                break;
+            }
 
-    char *tpl = tpl_cached("base.html");
-    if (tpl == NULL) {
-        return NULL;
+            fprintf(stderr, "invalid shard: %s\n", optarg);
+            return EXIT_FAILURE;
+        case OPT_MERGE:
+            is_merge = true;
+            break;
+        case OPT_TRACE:
+            trace_path = optarg;
+            break;
+        case OPT_CHECK:
+            is_check = true;
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-i input dir] [-o output dir] [-t theme dir] "
+                    "[-r root url] [-c cache file] [-a tar file] "
+                    "[-s static dir] [-x search index] [-m manifest file] "
+                    "[-b jobs file] [-S addr:port] [-f feed posts] [-l] [-P] "
+                    "[-v] [--shard i/N] [--merge] [--trace file] [--check] "
+                    "[page ... | shard dir ...]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
     }
 
-    char *content = NULL;
-    if (page->parent == NULL) {
-        // home page
-        content = plugin_home_alloc(page);
-    } else if (strcmp(page->parent->name, PLUGIN_BLOG_PAGE) == 0) {
-        // blog page
-        content = plugin_blog_post_alloc(page);
-    } else {
-        // simple page
-        content = plugin_page_alloc(page);
+    // server runs until killed, its spans would pile up
+    if (trace_path != NULL && srv_addr == NULL) {
+        trace_open(trace_path);
     }
 
-    if (content == NULL) {
-        return NULL;
+    struct hc *hc = hc_alloc(tpl_path);
+    if (preload) {
+        tpl_preload(hc);
     }
 
-    char *footer = page_conf(page, "footer", NULL);
-    char *blog_list = plugin_blog_list_alloc(page);
-    char *menu = plugin_menu_alloc(page);
-    char *desc = page_conf(page, "meta.description", NULL);
-    char *lang = page_conf(page, "language", "en");
+    // pages are rendered on request, nothing is written
+    if (srv_addr != NULL) {
+        bool is_ok = srv_run(hc, srv_addr, in_path, root_url, static_path);
+        hc_free(hc);
+        return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    char title[PLUGIN_BASE_TITLE_MAX] = "";
-    char *site_name = page_conf(page, "site.name", NULL);
-    if (page->parent != NULL) {
-        char *page_title = page_conf(page, "title", NULL);
-        char *title_delim = page_conf(page, "site.title.delimiter", " | ");
-        strcat_safe(title, page_title, sizeof(title));
-        strcat_safe(title, title_delim, sizeof(title));
-        strcat_safe(title, site_name, sizeof(title));
-    } else {
-        strcat_safe(title, site_name, sizeof(title));
+    // shard output dirs are given instead of pages, pages aren't rendered
+    if (is_merge) {
+        bool is_ok = shard_merge_run(in_path, out_path, tar_path, root_url,
+                                     argv + optind, argc - optind);
+        hc_free(hc);
+        manifest_free();
+        search_free();
+
+        if (s_trace_path != NULL && !trace_write()) {
+            is_ok = false;
+        }
+
+        trace_free();
+
+        // don't mix output with messages
+        if (strcmp(tar_path != NULL ? tar_path : out_path, "-") != 0) {
+            puts("done");
+        }
+
+        return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    struct strsub_pair pairs[] = {
-        {"{{ content }}", content},  //
-        {"{{ footer }}", footer},    //
-        {"{{ blog }}", blog_list},   //
-        {"{{ menu }}", menu},        //
-        {"{{ description }}", desc}, //
-        {"{{ title }}", title},      //
-        {"{{ name }}", site_name},   //
-        {"{{ root }}", s_root_url},  //
-        {"{{ language }}", lang},    //
-    };
+    // the whole site is rendered in memory, nothing is written
+    if (is_check) {
+        bool is_ok = check_run(hc, in_path, root_url);
+        hc_free(hc);
+        scratch_thread_free();
 
-    char *str = strsub_alloc(tpl, pairs, ARRAY_LEN(pairs));
-    free(content);
-    free(blog_list);
-    free(menu);
-    return str;
-}
+        if (s_trace_path != NULL && !trace_write()) {
+            is_ok = false;
+        }
 
-/// Generate
+        trace_free();
+
+        puts(is_ok ? "ok" : "failed");
+        return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // site options don't apply to batch, every job is a full build
+    if (jobs_path != NULL) {
+        s_search_path = NULL;
+        s_links_enabled = false;
+        s_manifest_path = NULL;
+        s_shard_count = 1;
+        s_feed_count = 0;
+
+        bool is_ok = batch_run(hc, jobs_path);
+        hc_free(hc);
+        scratch_thread_free();
+
+        if (s_trace_path != NULL && !trace_write()) {
+            is_ok = false;
+        }
+
+        trace_free();
+
+        puts("done");
+        return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // pages to generate, the whole site if none
+    char **targets = argv + optind;
+    int target_count = argc - optind;
+
+    // index of few pages would replace index of the whole site,
+    // links to other pages can't be checked without generating them
+    if (target_count > 0) {
+        s_search_path = NULL;
+        s_links_enabled = false;
+    }
+
+    // index and manifest describe the whole site, so they are left to merge
+    if (s_shard_count > 1) {
+        s_search_path = NULL;
+        s_manifest_path = NULL;
+    }
+
+    struct page *tree = NULL;
+    if (cache_path != NULL) {
+        tree = cache_load(cache_path, in_path);
+    }
+
+    if (tree == NULL) {
+        // read only structure unless it's cached, confs are read while
+        // pages are generated
+        bool is_lazy = target_count > 0 || cache_path == NULL;
+        tree = page_tree_alloc(in_path, "", is_lazy);
+        if (tree == NULL) {
+            hc_free(hc);
+            return EXIT_FAILURE;
+        }
 
-static void generate_pages(struct page *page, char *out_path) {
-    assert(page != NULL);
-    assert(out_path != NULL);
+        if (cache_path != NULL && !is_lazy) {
+            cache_write(tree, in_path, cache_path);
+        }
+    }
 
-    // result path for page
-    char path[PATH_MAX];
-    strcpy_safe(path, out_path, sizeof(path));
-    page_url_append(page, path, sizeof(path));
+    page_urls_alloc(tree, root_url);
+    plugin_blog_sort(tree);
 
-    // write generated page
-    char *str = plugin_base_alloc(page);
-    if (str != NULL) {
-        mkdir_p(path);
-        file_write(path, str);
-        free(str);
+    // only full builds replace output dir
+    struct out out;
+    if (!out_open(&out, out_path, tar_path, target_count == 0)) {
+        page_free(tree);
+        cache_free();
+        hc_free(hc);
+        return EXIT_FAILURE;
     }
 
-    // generate children
-    for (size_t i = 0; i < page->child_count; ++i) {
-        struct page **child = &page->children[i];
-        generate_pages(*child, out_path);
+    int status = EXIT_SUCCESS;
+    if (target_count == 0) {
+        pipe_run(hc, &out, tree, in_path);
     }
-}
 
-#ifndef TEST
+    for (int i = 0; i < target_count; ++i) {
+        if (!generate_target(hc, &out, tree, in_path, targets[i])) {
+            status = EXIT_FAILURE;
+        }
+    }
 
-/// EP
+    // static files are copied by the first shard only
+    if (static_path != NULL && s_shard_index == 0) {
+        out_copy_dir(&out, static_path, "");
+    }
 
-int main(int argc, char *argv[]) {
-    char *in_path = "content";
-    char *out_path = "public";
+    if (s_search_path != NULL) {
+        search_write(&out);
+    }
 
-    int opt;
-    while ((opt = getopt(argc, argv, "i:o:t:r:v")) != -1) {
-        switch (opt) {
-        case 'i':
-            in_path = optarg;
-            break;
-        case 'o':
-            out_path = optarg;
-            break;
-        case 't':
-            s_tpl_path = optarg;
-            break;
-        case 'r':
-            s_root_url = optarg;
-            break;
-        case 'v':
-            puts("version " STR(VERSION));
-            return EXIT_SUCCESS;
-        default:
-            fprintf(stderr,
-                    "Usage: %s [-i input dir] [-o output dir] [-t theme dir] "
-                    "[-r root url] [-v]\n",
-                    argv[0]);
-            return EXIT_FAILURE;
-        }
+    if (s_links_enabled && links_check(tree, in_path, static_path) > 0) {
+        status = EXIT_FAILURE;
     }
 
-    struct page *tree = page_tree_alloc(in_path, "");
-    if (tree == NULL) {
-        return EXIT_FAILURE;
+    if (!out_close(&out)) {
+        status = EXIT_FAILURE;
+    } else if (s_manifest_path != NULL) {
+        // describe only published output
+        manifest_write(root_url, target_count == 0);
     }
 
-    generate_pages(tree, out_path);
+    if (s_trace_path != NULL && !trace_write()) {
+        status = EXIT_FAILURE;
+    }
 
     // cleanup
     page_free(tree);
-    tpl_cache_free();
-
-    puts("done");
+    cache_free();
+    hc_free(hc);
+    scratch_thread_free();
+    search_free();
+    links_free();
+    manifest_free();
+    trace_free();
+
+    // don't mix output with messages
+    bool is_stdout = strcmp(tar_path != NULL ? tar_path : out_path, "-") == 0;
+    if (!is_stdout) {
+        puts("done");
+    }
 
-    return EXIT_SUCCESS;
+    return status;
 }
 
-#else
+#elif defined(TEST)
 
 /// Tests
 
+struct test_file {
+    char *path; // relative to temp dir, dirs end with slash
+    char *str;  // NULL for dirs
+};
+
+// temp dir like "/tmp/hc-test-XXXXXX" is created with given files and their
+// parent dirs, it's removed with remove_at(AT_FDCWD, dir)
+static void test_dir_make(char *dir, struct test_file *files,
+                          size_t file_count) {
+    assert(dir != NULL);
+    assert(mkdtemp(dir) != NULL);
+
+    for (size_t i = 0; i < file_count; ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i].path);
+        mkdir_p(path);
+
+        if (files[i].str != NULL) {
+            file_write(AT_FDCWD, path, files[i].str, strlen(files[i].str));
+        }
+    }
+}
+
 static void test_buf(void) {
     struct buf buf = {0};
     buf_realloc(&buf, 5);
@@ -1037,6 +7332,30 @@ static void test_buf(void) {
     buf_free(buf);
 }
 
+static void test_scratch(void) {
+    struct scratch scratch = {0};
+    struct buf *buf1 = scratch_buf(&scratch);
+    assert(buf1->len == 0 && strcmp(buf1->buf, "") == 0);
+    buf_append(buf1, "abc", 3);
+    assert(strcmp(buf1->buf, "abc") == 0);
+
+    // released buffers are reused with their memory
+    size_t mark = scratch_mark(&scratch);
+    struct buf *buf2 = scratch_buf(&scratch);
+    buf_append(buf2, "def", 3);
+    char *mem = buf2->buf;
+    scratch_release(&scratch, mark);
+    assert(scratch_buf(&scratch) == buf2);
+    assert(buf2->buf == mem && strcmp(buf2->buf, "") == 0);
+    assert(strcmp(buf1->buf, "abc") == 0);
+
+    scratch_reset(&scratch);
+    assert(scratch_buf(&scratch) == buf1);
+    assert(scratch.buf_count == 2);
+
+    scratch_free(&scratch);
+}
+
 static void test_strcpy_safe(void) {
     char buf[8] = "hello";
     strcpy_safe(buf, "hello, world", sizeof(buf));
@@ -1052,7 +7371,7 @@ static void test_strcat_safe(void) {
     assert(strcmp(buf, "hello, ") == 0);
 }
 
-static void test_strsub_alloc(void) {
+static void test_strsub_scratch(void) {
     char *str = "original read-only string";
 
     struct strsub_pair pairs[] = {
@@ -1064,11 +7383,279 @@ static void test_strsub_alloc(void) {
         {"array", "sequence"},
     };
 
-    char *replaced = strsub_alloc(str, pairs, ARRAY_LEN(pairs));
+    struct scratch scratch = {0};
+    char *replaced = strsub_scratch(&scratch, str, pairs, ARRAY_LEN(pairs));
     assert(strcmp(replaced, " write-only character sequence") == 0);
     assert(strcmp(str, "original read-only string") == 0);
 
-    free(replaced);
+    scratch_free(&scratch);
+}
+
+static void test_strsub_scratch_filter(void) {
+    char *str = "{{ title }} {{ title | escape }} {{ title | unknown }}";
+
+    struct strsub_pair pairs[] = {
+        {"{{ title }}", "<a & 'b'>"},
+    };
+
+    struct scratch scratch = {0};
+    char *replaced = strsub_scratch(&scratch, str, pairs, ARRAY_LEN(pairs));
+    assert(strcmp(replaced, "<a & 'b'> &lt;a &amp; &#39;b&#39;&gt; "
+                            "{{ title | unknown }}") == 0);
+
+    // escaped value buffer is released
+    assert(scratch.used == 1);
+    scratch_free(&scratch);
+}
+
+static void test_html_escape_buf(void) {
+    struct buf buf = {0};
+    html_escape_buf(&buf, "");
+    assert(strcmp(buf.buf, "") == 0 && buf.len == 0);
+
+    html_escape_buf(&buf, "nothing to escape in this long string");
+    assert(strcmp(buf.buf, "nothing to escape in this long string") == 0);
+
+    // specials before, inside and after 16 byte chunks
+    html_escape_buf(&buf, "\"0123456789abcdef<0123456789abcdef&x'");
+    assert(strcmp(buf.buf, "&quot;0123456789abcdef&lt;0123456789abcdef&amp;x"
+                           "&#39;") == 0);
+
+    html_escape_buf(&buf, "<<>>");
+    assert(strcmp(buf.buf, "&lt;&lt;&gt;&gt;") == 0);
+    assert(buf.len == strlen(buf.buf));
+
+    buf_free(buf);
+}
+
+static void test_md_alloc(void) {
+    char *html = md_alloc("");
+    assert(strcmp(html, "") == 0);
+    free(html);
+
+    char str[] = "# Title\n\
+\n\
+Some *em*, **strong**, `<code>` and snake_case_name\n\
+on two lines with [link]({{ root }}/page.html).\n\
+\n\
+- one\n\
+- ![img](a.png)\n\
+1. first\n\
+\n\
+> quote\n\
+---\n\
+```\n\
+a < b\n\
+```\n\
+<div>\n\
+*raw*\n\
+</div>";
+
+    html = md_alloc(str);
+    assert(strcmp(html, "<h1>Title</h1>\n\
+<p>Some <em>em</em>, <strong>strong</strong>, <code>&lt;code&gt;</code> and \
+snake_case_name\n\
+on two lines with <a href=\"{{ root }}/page.html\">link</a>.</p>\n\
+<ul>\n\
+<li>one</li>\n\
+<li><img src=\"a.png\" alt=\"img\"></li>\n\
+</ul>\n\
+<ol>\n\
+<li>first</li>\n\
+</ol>\n\
+<blockquote><p>quote</p></blockquote>\n\
+<hr>\n\
+<pre><code>a &lt; b\n\
+</code></pre>\n\
+<div>\n\
+*raw*\n\
+</div>\n") == 0);
+    free(html);
+
+    // text and urls are escaped, entities and inline tags are kept
+    html = md_alloc("Tom & Jerry say a < b, see [x](/a\"b.html)\n\
+&amp; &#39; <br> \\< &x");
+    assert(strcmp(html, "<p>Tom &amp; Jerry say a &lt; b, see \
+<a href=\"/a&quot;b.html\">x</a>\n\
+&amp; &#39; <br> &lt; &amp;x</p>\n") == 0);
+    free(html);
+}
+
+static void test_map(void) {
+    struct map map = {0};
+    assert(map_find(&map, "key", 3) == NULL);
+
+    char keys[64][8];
+    for (size_t i = 0; i < ARRAY_LEN(keys); ++i) {
+        snprintf(keys[i], sizeof(keys[i]), "key %zu", i);
+        assert(map_put(&map, keys[i], strlen(keys[i]), keys[i]) == NULL);
+    }
+
+    assert(map.count == ARRAY_LEN(keys));
+    for (size_t i = 0; i < ARRAY_LEN(keys); ++i) {
+        assert(map_find(&map, keys[i], strlen(keys[i])) == keys[i]);
+    }
+
+    // keys are compared by length too
+    assert(map_find(&map, "key 1", 4) == NULL);
+
+    assert(map_put(&map, "key 1", 5, "value") == keys[1]);
+    assert(strcmp(map_find(&map, "key 1", 5), "value") == 0);
+    assert(map.count == ARRAY_LEN(keys));
+
+    // other keys are still found after removed ones
+    for (size_t i = 0; i < ARRAY_LEN(keys); i += 2) {
+        assert(map_remove(&map, keys[i], strlen(keys[i])) == keys[i]);
+    }
+
+    assert(map_remove(&map, keys[0], strlen(keys[0])) == NULL);
+    assert(map.count == ARRAY_LEN(keys) / 2);
+    for (size_t i = 1; i < ARRAY_LEN(keys); i += 2) {
+        assert(map_find(&map, keys[i], strlen(keys[i])) != NULL);
+        assert(map_find(&map, keys[i - 1], strlen(keys[i - 1])) == NULL);
+    }
+
+    map_free(map, NULL);
+}
+
+static void test_frag(void) {
+    struct buf key1 = {0};
+    frag_key_add(&key1, "tpl");
+    frag_key_add(&key1, "ab");
+    frag_key_add(&key1, NULL);
+
+    // same concatenation, different values
+    struct buf key2 = {0};
+    frag_key_add(&key2, "tpl");
+    frag_key_add(&key2, "a");
+    frag_key_add(&key2, "b");
+
+    struct hc *hc = hc_alloc("theme");
+    assert(frag_find(hc, &key1) == NULL);
+    char *str = frag_add(hc, &key1, "fragment");
+    assert(strcmp(str, "fragment") == 0);
+
+    // cached fragment is never replaced
+    char *cached = frag_find(hc, &key1);
+    assert(strcmp(cached, "fragment") == 0);
+    assert(frag_add(hc, &key1, "other") == cached);
+    assert(frag_find(hc, &key2) == NULL);
+
+    buf_free(key1);
+    buf_free(key2);
+    hc_free(hc);
+}
+
+static void test_tpl_render(void) {
+    char *strs[] = {
+        "",
+        "no placeholders",
+        "{{ a }}{{ b }} {{ a | escape }} {{ c }}",
+        "{{ {{ a }} }} {{ b",
+        "{{ a | unknown }} {{ b | escape }}{{ a }}",
+    };
+
+    // values with placeholders are substituted with the following pairs
+    struct strsub_pair pairs[] = {
+        {"{{ a }}", "<{{ b }}>"},
+        {"{{ b }}", "'b' {{ a }}"},
+        {"{{ d }}", NULL},
+    };
+
+    struct scratch scratch = {0};
+    for (size_t i = 0; i < ARRAY_LEN(strs); ++i) {
+        struct tpl tpl = {strdup(strs[i]), NULL, 0, false};
+        tpl_compile(&tpl);
+
+        char *rendered = tpl_render(&scratch, &tpl, pairs, ARRAY_LEN(pairs));
+        char *replaced = strsub_scratch(&scratch, strs[i], pairs,
+                                        ARRAY_LEN(pairs));
+        assert(strcmp(rendered, replaced) == 0);
+        scratch_reset(&scratch);
+
+        free(tpl.str);
+        free(tpl.segs);
+    }
+
+    struct tpl tpl = {strdup("x {{ a }} y"), NULL, 0, false};
+    tpl_compile(&tpl);
+    assert(tpl.seg_count == 2);
+    assert(strncmp(tpl.segs[0].ph, "{{ a }}", tpl.segs[0].ph_len) == 0);
+    assert(strcmp(tpl.segs[1].text, " y") == 0);
+    assert(tpl.segs[1].ph == NULL);
+
+    free(tpl.str);
+    free(tpl.segs);
+    scratch_free(&scratch);
+}
+
+static char *test_tpl_lazy_alloc(void *arg) {
+    int *call_count = arg;
+    ++*call_count;
+    return "x";
+}
+
+static void test_tpl_render_lazy(void) {
+    int b_count = 0;
+    int c_count = 0;
+    int d_count = 0;
+
+    // c is used only by value of a, d is not used at all
+    struct strsub_pair pairs[] = {
+        {"{{ a }}", "<{{ c | escape }}>"},
+        {"{{ b }}", NULL},
+        {"{{ c }}", NULL},
+        {"{{ d }}", NULL},
+    };
+
+    struct tpl_lazy lazy[] = {
+        {NULL, NULL},
+        {test_tpl_lazy_alloc, &b_count},
+        {test_tpl_lazy_alloc, &c_count},
+        {test_tpl_lazy_alloc, &d_count},
+    };
+
+    struct tpl tpl = {strdup("{{ a }} {{ b | escape }}"), NULL, 0, false};
+    tpl_compile(&tpl);
+
+    struct scratch scratch = {0};
+    char *rendered =
+        tpl_render_lazy(&scratch, &tpl, pairs, lazy, ARRAY_LEN(pairs));
+    assert(strcmp(rendered, "<x> x") == 0);
+    assert(b_count == 1);
+    assert(c_count == 1);
+    assert(d_count == 0);
+    assert(pairs[3].rep == NULL);
+
+    free(tpl.str);
+    free(tpl.segs);
+    scratch_free(&scratch);
+}
+
+static void test_tpl_preload(void) {
+    char dir[] = "/tmp/hc-test-XXXXXX";
+    struct test_file files[] = {
+        {"page.html", "page"},      //
+        {"blog/list.html", "list"}, //
+    };
+    test_dir_make(dir, files, ARRAY_LEN(files));
+
+    // symlinked template is preloaded too
+    char link_path[PATH_MAX];
+    snprintf(link_path, sizeof(link_path), "%s/post.html", dir);
+    assert(symlink("page.html", link_path) == 0);
+
+    struct hc *hc = hc_alloc(dir);
+    tpl_preload(hc);
+    assert(hc->tpls.count == 3);
+    assert(strcmp(tpl_cached(hc, "page.html")->str, "page") == 0);
+    assert(strcmp(tpl_cached(hc, "post.html")->str, "page") == 0);
+    assert(strcmp(tpl_cached(hc, "blog/list.html")->str, "list") == 0);
+    assert(tpl_cached(hc, "missing.html") == NULL);
+    assert(hc->tpls.count == 4);
+    hc_free(hc);
+
+    remove_at(AT_FDCWD, dir);
 }
 
 static void test_conf_read(void) {
@@ -1114,6 +7701,89 @@ content";
     conf_read(&conf, invalid_str);
     assert(conf.pair_count == 0);
     assert(strcmp(conf.content, "invalid") == 0);
+
+    // delimiter of the next line doesn't belong to the skipped line
+    char skip_str[] = "---\n\
+no delimiter\n\
+\n\
+key = a = b\n\
+---\n\
+content";
+
+    conf_read(&conf, skip_str);
+    assert(conf.skip_count == 1);
+    assert(conf.pair_count == 1);
+    assert(strcmp(conf.pairs[0].key, "key") == 0);
+    assert(strcmp(conf.pairs[0].val, "a = b") == 0);
+    assert(strcmp(conf.content, "content") == 0);
+
+    // no limit on number of pairs
+    struct buf buf = {0};
+    buf_append(&buf, CONF_FM_DELIM, CONF_FM_DELIM_LEN);
+    for (size_t i = 0; i < 1000; ++i) {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "key %zu = value %zu\n", i, i);
+        buf_append(&buf, line, len);
+    }
+
+    conf_read(&conf, buf.buf);
+    assert(conf.pair_count == 1000);
+    assert(strcmp(conf.pairs[999].key, "key 999") == 0);
+    assert(strcmp(conf.pairs[999].val, "value 999") == 0);
+    assert(conf.content == NULL);
+
+    buf_free(buf);
+    free(conf.pairs);
+}
+
+static void test_conf_alloc(void) {
+    char path[] = "/tmp/hc-test-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    char full_str[] = "---\nkey = value\n---\ncontent";
+    file_write(AT_FDCWD, path, full_str, strlen(full_str));
+
+    struct conf conf = conf_alloc(path);
+    assert(conf.pair_count == 1);
+    assert(strcmp(conf.pairs[0].val, "value") == 0);
+    assert(conf.content == NULL);
+    assert(conf.content_offset == 20);
+
+    conf_content_load(&conf, path);
+    assert(strcmp(conf.content, "content") == 0);
+    conf_free(conf);
+
+    char keys_str[] = "---\nkey = value\n---";
+    file_write(AT_FDCWD, path, keys_str, strlen(keys_str));
+
+    conf = conf_alloc(path);
+    assert(conf.pair_count == 1);
+    assert(conf.content_offset == -1);
+    conf_content_load(&conf, path);
+    assert(conf.content == NULL);
+    conf_free(conf);
+
+    char content_str[] = "content";
+    file_write(AT_FDCWD, path, content_str, strlen(content_str));
+
+    conf = conf_alloc(path);
+    assert(conf.pair_count == 0);
+    assert(conf.content_offset == 0);
+    conf_content_load(&conf, path);
+    assert(strcmp(conf.content, "content") == 0);
+    conf_free(conf);
+
+    file_write(AT_FDCWD, path, "", 0);
+
+    conf = conf_alloc(path);
+    assert(conf.content_offset == 0);
+    conf_content_load(&conf, path);
+    assert(strcmp(conf.content, "") == 0);
+    conf_free(conf);
+
+    remove(path);
 }
 
 static void test_conf_find(void) {
@@ -1394,6 +8064,75 @@ static void test_page_url_append(void) {
     page_free(root);
 }
 
+static void test_page_urls_alloc(void) {
+    struct page *root = page_alloc("root");
+    struct page *child1 = page_alloc("child1");
+    struct page *child2 = page_alloc("child2");
+    struct page *child3 = page_alloc(".child3");
+    page_add(root, child1);
+    page_add(root, child2);
+    page_add(child2, child3);
+
+    page_urls_alloc(root, "https://example.com");
+
+    assert(strcmp(root->url, "https://example.com/index.html") == 0);
+    assert(strcmp(root->path, "/index.html") == 0);
+    assert(strcmp(child1->url, "https://example.com/child1") == 0);
+    assert(strcmp(child1->path, "/child1") == 0);
+    assert(strcmp(child2->path, "/child2/index.html") == 0);
+    assert(strcmp(child3->path, "/child2/.child3") == 0);
+
+    page_free(root);
+}
+
+static void test_plugin_feed_alloc(void) {
+    struct page *root = page_alloc("");
+    struct page *blog = page_alloc(PLUGIN_BLOG_PAGE);
+    struct page *post1 = page_alloc("2024-01-01.html");
+    struct page *post2 = page_alloc("2024-01-02.html");
+    page_add(root, blog);
+    page_add(blog, post1);
+    page_add(blog, post2);
+    page_urls_alloc(root, "https://example.com");
+    plugin_blog_sort(root);
+
+    conf_read(&root->conf, strdup("---\nsite.name = A & B\n---\n"));
+    conf_read(&post1->conf, strdup("---\ntitle = <Old>\n---\n"));
+    conf_read(&post2->conf, strdup("---\ntitle = New\n"
+                                   "meta.description = \"New\" post\n---\n"));
+
+    assert(plugin_feed_is_blog(blog));
+    assert(!plugin_feed_is_blog(post1));
+
+    // only the newest post is in feed
+    struct scratch scratch = {0};
+    char *str = plugin_feed_alloc(&scratch, blog, 1);
+    assert(strcmp(str, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n\
+<feed xmlns=\"http://www.w3.org/2005/Atom\">\n\
+<title>A &amp; B</title>\n\
+<id>https://example.com/blog/feed.xml</id>\n\
+<link rel=\"self\" href=\"https://example.com/blog/feed.xml\"/>\n\
+<updated>2024-01-02T00:00:00Z</updated>\n\
+<author>\n\
+<name>A &amp; B</name>\n\
+</author>\n\
+<entry>\n\
+<title>New</title>\n\
+<id>https://example.com/blog/2024-01-02.html</id>\n\
+<link rel=\"alternate\" href=\"https://example.com/blog/2024-01-02.html\"/>\n\
+<updated>2024-01-02T00:00:00Z</updated>\n\
+<summary>&quot;New&quot; post</summary>\n\
+</entry>\n\
+</feed>\n") == 0);
+
+    scratch_reset(&scratch);
+    str = plugin_feed_alloc(&scratch, blog, 10);
+    assert(strstr(str, "<title>&lt;Old&gt;</title>") != NULL);
+
+    scratch_free(&scratch);
+    page_free(root);
+}
+
 static void test_page_find_by_page_path(void) {
     struct page *root = page_alloc("root");
     struct page *child1 = page_alloc("child1");
@@ -1428,13 +8167,604 @@ static void test_page_find_by_page_path(void) {
     page_free(root);
 }
 
+static void test_page_load(void) {
+    char dir[] = "/tmp/hc-test-XXXXXX";
+    struct test_file files[] = {
+        {"index.html", "---\ntitle = root\n---\n"},      //
+        {"page.html", "page content"},                   //
+        {"post.md", "---\ntitle = post\n---\n*post*\n"}, //
+    };
+    test_dir_make(dir, files, ARRAY_LEN(files));
+
+    struct page *tree = page_tree_alloc(dir, "", true);
+    page_urls_alloc(tree, "");
+
+    struct page *page = page_find(tree, "page.html");
+    assert(page != NULL);
+    assert(!page->is_loaded);
+    assert(page_conf(page, "title", NULL) == NULL);
+
+    page_load(page, dir);
+    page_load(tree, dir);
+    assert(page->is_loaded);
+    assert(strcmp(page_conf(page, "title", NULL), "root") == 0);
+
+    // content is read separately
+    assert(page_content(tree, NULL) == NULL);
+    assert(page_content(page, NULL) == NULL);
+    page_content_load(tree, dir);
+    page_content_load(page, dir);
+    assert(strcmp(page_content(tree, NULL), "") == 0);
+    assert(strcmp(page_content(page, NULL), "page content") == 0);
+
+    page_content_free(page);
+    assert(page_content(page, NULL) == NULL);
+
+    // markdown source is rendered into html page
+    struct page *md = page_find(tree, "post.html");
+    assert(md != NULL);
+    assert(md->is_markdown);
+
+    page_load(md, dir);
+    assert(strcmp(page_conf(md, "title", NULL), "post") == 0);
+    page_content_load(md, dir);
+    assert(strcmp(page_content(md, NULL), "<p><em>post</em></p>\n") == 0);
+
+    page_free(tree);
+    remove_at(AT_FDCWD, dir);
+}
+
+static void test_tar_header_path(void) {
+    struct tar_header header = {0};
+    assert(tar_header_path(&header, "blog/index.html"));
+    assert(strcmp(header.name, "blog/index.html") == 0);
+    assert(*header.prefix == '\0');
+
+    char path[200] = "";
+    memset(path, 'a', 120);
+    strcat(path, "/b/");
+    memset(path + strlen(path), 'c', 50);
+
+    header = (struct tar_header){0};
+    assert(tar_header_path(&header, path));
+    assert(strlen(header.prefix) == 120);
+    assert(strlen(header.name) == 52);
+
+    memset(path, 'a', sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    assert(!tar_header_path(&header, path));
+}
+
+static void test_out_publish(void) {
+    char dir[] = "/tmp/hc-test-XXXXXX";
+    test_dir_make(dir, NULL, 0);
+
+    char out_path[PATH_MAX];
+    char page_path[PATH_MAX];
+    char old_path[PATH_MAX];
+    snprintf(out_path, sizeof(out_path), "%s/public/", dir);
+    snprintf(page_path, sizeof(page_path), "%s/public/a/b/page.html", dir);
+    snprintf(old_path, sizeof(old_path), "%s/public/old.html", dir);
+
+    // first build creates output dir
+    struct out out;
+    assert(out_open(&out, out_path, NULL, true));
+    out_write(&out, "/old.html", "old", 3);
+    assert(out_close(&out));
+    assert(access(old_path, F_OK) == 0);
+
+    // next build replaces it
+    assert(out_open(&out, out_path, NULL, true));
+    out_write(&out, "/a/b/page.html", "page", 4);
+    out_write(&out, "/a/index.html", "index", 5);
+    assert(access(page_path, F_OK) == -1);
+    assert(out_close(&out));
+
+    assert(access(old_path, F_OK) == -1);
+    char *str = file_alloc(page_path, NULL);
+    assert(strcmp(str, "page") == 0);
+    free(str);
+
+    // failed build keeps the old output
+    assert(out_open(&out, out_path, NULL, true));
+    out_write(&out, "/a/index.html", "new", 3);
+    out_write(&out, "/a/index.html/page.html", "page", 4);
+    assert(!out_close(&out));
+
+    str = file_alloc(page_path, NULL);
+    assert(strcmp(str, "page") == 0);
+    free(str);
+
+    // and leaves nothing behind
+    remove_at(AT_FDCWD, out_path);
+    assert(remove(dir) == 0);
+}
+
+static void test_out_copy_dir(void) {
+    char dir[] = "/tmp/hc-test-XXXXXX";
+    struct test_file files[] = {
+        {"static/a.css", "a"},     //
+        {"static/sub/b.css", "b"}, //
+    };
+    test_dir_make(dir, files, ARRAY_LEN(files));
+
+    char static_path[PATH_MAX];
+    char out_path[PATH_MAX];
+    char path[PATH_MAX];
+    snprintf(static_path, sizeof(static_path), "%s/static", dir);
+    snprintf(out_path, sizeof(out_path), "%s/public", dir);
+
+    // symlinks are copied as files they point to
+    snprintf(path, sizeof(path), "%s/link.css", static_path);
+    assert(symlink("a.css", path) == 0);
+    snprintf(path, sizeof(path), "%s/link", static_path);
+    assert(symlink("sub", path) == 0);
+
+    struct out out;
+    assert(out_open(&out, out_path, NULL, true));
+    out_copy_dir(&out, static_path, "");
+    assert(out_close(&out));
+
+    char *names[] = {"a.css", "sub/b.css", "link.css", "link/b.css"};
+    for (size_t i = 0; i < ARRAY_LEN(names); ++i) {
+        snprintf(path, sizeof(path), "%s/%s", out_path, names[i]);
+        struct stat st;
+        assert(lstat(path, &st) == 0 && S_ISREG(st.st_mode));
+    }
+
+    remove_at(AT_FDCWD, dir);
+}
+
+static void test_search_alloc(void) {
+    struct page *root = page_alloc("");
+    struct page *post = page_alloc("post.html");
+    struct page *dir = page_alloc("dir");
+    page_add(root, post);
+    page_add(root, dir);
+    page_urls_alloc(root, "");
+
+    conf_read(&root->conf,
+              strdup("---\ntitle = Home\n---\n<style>p { x: y; }</style>"
+                     "<p>Hello &amp; {{ root }} world</p>"));
+    conf_read(&post->conf,
+              strdup("---\ntitle = Post\n---\nHello, HELLO again!"));
+
+    assert(search_page_add(root) == 0);
+    assert(search_page_add(post) == 1);
+
+    // removed doc and its terms aren't written
+    conf_read(&dir->conf, strdup("---\ntitle = Dir\n---\nhello directory"));
+    search_doc_remove(search_page_add(dir));
+
+    size_t len = 0;
+    char *str = search_alloc(&len);
+    assert(strcmp(str, "hcx-search 1\n\
+2\n\
+/index.html\tHome\n\
+/post.html\tPost\n\
+5\n\
+0 again 1\n\
+0 hello 0 1\n\
+1 ome 0\n\
+0 post 1\n\
+0 world 0\n") == 0);
+    assert(len == strlen(str));
+
+    free(str);
+    search_free();
+    page_free(root);
+}
+
+static void test_link_path(void) {
+    char path[PATH_MAX] = "/a/./b/../c/";
+    link_path_normalize(path, sizeof(path));
+    assert(strcmp(path, "/a/c/") == 0);
+
+    strcpy_safe(path, "/../a/..", sizeof(path));
+    link_path_normalize(path, sizeof(path));
+    assert(strcmp(path, "/") == 0);
+
+    struct page *root = page_alloc("");
+    struct page *blog = page_alloc("blog");
+    struct page *post = page_alloc("post.html");
+    page_add(root, blog);
+    page_add(blog, post);
+    page_urls_alloc(root, "");
+
+    struct link link = {post, "../index.html?x#y", 0, false};
+    assert(link_path(&link, path, sizeof(path)));
+    assert(strcmp(path, "/index.html") == 0);
+
+    link.href = "/blog/";
+    assert(link_path(&link, path, sizeof(path)));
+    assert(strcmp(path, "/blog/") == 0);
+
+    link.href = "other.html";
+    assert(link_path(&link, path, sizeof(path)));
+    assert(strcmp(path, "/blog/other.html") == 0);
+
+    link.href = "https://example.com/";
+    assert(!link_path(&link, path, sizeof(path)));
+    link.href = "//example.com/";
+    assert(!link_path(&link, path, sizeof(path)));
+    link.href = "mailto:user@example.com";
+    assert(!link_path(&link, path, sizeof(path)));
+    link.href = "#top";
+    assert(!link_path(&link, path, sizeof(path)));
+
+    // only written pages are valid, blog dir has no page
+    links_add(post, "<a href=\"post.html\">");
+    assert(s_links.link_count == 1);
+    assert(link_valid(&s_links.links[0]));
+    link.href = "/blog/";
+    assert(!link_valid(&link));
+    links_free();
+
+    free(root->url);
+    free(blog->url);
+    free(post->url);
+    free(root->children);
+    free(blog->children);
+    free(root);
+    free(blog);
+    free(post);
+}
+
+static void test_manifest(void) {
+    char path[] = "/tmp/hc-test-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    char prev_str[] = "added\t0000000000000001\t1\t/same.html\n\
+added\t0000000000000002\t2\t/changed.html\n\
+unchanged\t0000000000000003\t3\t/removed.html\n\
+removed\t0000000000000004\t4\t/gone.html\n";
+    file_write(AT_FDCWD, path, prev_str, strlen(prev_str));
+
+    s_manifest_path = path;
+
+    // reuse previous hash to get unchanged entry
+    char same_str[] = "same";
+    manifest_add("/same.html", same_str, strlen(same_str));
+    struct manifest_entry *same = map_find(&s_manifest, "/same.html", 10);
+    same->hash = 1;
+    same->size = 1;
+
+    manifest_add("/changed.html", same_str, strlen(same_str));
+    manifest_add("/added.html", same_str, strlen(same_str));
+    manifest_write("", true);
+
+    char *str = file_alloc(path, NULL);
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016" PRIx64, hash_mem("same", 4));
+
+    char expected[PATH_MAX];
+    snprintf(expected, sizeof(expected), "added\t%s\t4\t/added.html\n\
+changed\t%s\t4\t/changed.html\n\
+removed\t0000000000000003\t3\t/removed.html\n\
+unchanged\t0000000000000001\t1\t/same.html\n",
+             hash, hash);
+    assert(strcmp(str, expected) == 0);
+    free(str);
+
+    manifest_free();
+    s_manifest_path = NULL;
+    remove(path);
+}
+
+static void test_shard_parse(void) {
+    size_t index = 0;
+    size_t count = 1;
+    assert(shard_parse("2/3", &index, &count));
+    assert(index == 2 && count == 3);
+
+    char *invalid[] = {"", "1", "3/3", "1/0", "-1/3", "1/3x", "/3", "1/+3"};
+    for (size_t i = 0; i < ARRAY_LEN(invalid); ++i) {
+        assert(!shard_parse(invalid[i], &index, &count));
+    }
+
+    assert(index == 2 && count == 3);
+
+    // every path belongs to exactly one shard, the same on every run
+    char *path = "/blog/2024-04-20.html";
+    assert(shard_of(path, 1) == 0);
+    assert(shard_of(path, 7) == hash_mem(path, strlen(path)) % 7);
+}
+
+static void test_trace(void) {
+    // disabled spans are not recorded
+    trace_end("test", "disabled", trace_begin());
+    assert(s_trace.threads == NULL);
+
+    char path[] = "/tmp/hc-test-trace.XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    trace_open(path);
+    uint64_t start = trace_begin();
+    assert(start != 0);
+    trace_end("test", "\"quoted\"\n", start);
+    assert(s_trace.threads != NULL && s_trace.threads->next == NULL);
+    assert(s_trace.threads->event_count == 1);
+    assert(s_trace.threads->tid == trace_tid());
+    assert(trace_write());
+
+    // name is escaped, the only event has no trailing comma
+    char *expected = "{\"traceEvents\":[\n"
+                     "{\"name\":\"\\\"quoted\\\"\\u000a\",\"cat\":\"test\",";
+    char *str = file_alloc(path, NULL);
+    assert(strncmp(str, expected, strlen(expected)) == 0);
+    assert(strcmp(str + strlen(str) - 5, "}\n]}\n") == 0);
+    free(str);
+
+    trace_free();
+    assert(s_trace_path == NULL);
+    remove(path);
+}
+
+static void test_check_ph_find(void) {
+    char ph[16];
+    check_ph_find(ph, sizeof(ph), "<p>no placeholders</p>");
+    assert(strcmp(ph, "") == 0);
+
+    check_ph_find(ph, sizeof(ph), "<p>{{ a }} {{ b }}</p>");
+    assert(strcmp(ph, "{{ a }}") == 0);
+
+    // unclosed placeholder is cut at the line end
+    check_ph_find(ph, sizeof(ph), "{{ a\n }}");
+    assert(strcmp(ph, "{{ a") == 0);
+
+    check_ph_find(ph, sizeof(ph), "{{ very long placeholder }}");
+    assert(strcmp(ph, "{{ very long pl") == 0);
+}
+
+static void test_pipe_queue(void) {
+    struct pipe_queue queue;
+    pipe_queue_init(&queue);
+
+    struct page pages[PIPE_QUEUE_CAP] = {0};
+    for (size_t i = 0; i < ARRAY_LEN(pages); ++i) {
+        struct pipe_item item = {&pages[i], NULL, SEARCH_DOC_NONE};
+        pipe_queue_push(&queue, item);
+    }
+
+    // items are popped in order, closed queue is drained first
+    struct pipe_item item = {0};
+    assert(pipe_queue_pop(&queue, &item) && item.page == &pages[0]);
+    pipe_queue_push(&queue, item);
+    pipe_queue_close(&queue);
+
+    for (size_t i = 1; i < ARRAY_LEN(pages); ++i) {
+        assert(pipe_queue_pop(&queue, &item) && item.page == &pages[i]);
+    }
+
+    assert(pipe_queue_pop(&queue, &item) && item.page == &pages[0]);
+    assert(!pipe_queue_pop(&queue, &item));
+
+    pipe_queue_destroy(&queue);
+}
+
+static void test_batch_read(void) {
+    char path[] = "/tmp/hc-test-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    char jobs_str[] = "# comment\n\
+a/content a/public https://a.org\n\
+\n\
+b/content   b/public\n";
+    file_write(AT_FDCWD, path, jobs_str, strlen(jobs_str));
+
+    struct batch batch = {0};
+    assert(batch_read(&batch, path));
+    assert(batch.site_count == 2);
+    assert(strcmp(batch.sites[0].in_path, "a/content") == 0);
+    assert(strcmp(batch.sites[0].out_path, "a/public") == 0);
+    assert(strcmp(batch.sites[0].root_url, "https://a.org") == 0);
+    assert(strcmp(batch.sites[1].in_path, "b/content") == 0);
+    assert(strcmp(batch.sites[1].out_path, "b/public") == 0);
+    assert(strcmp(batch.sites[1].root_url, "") == 0);
+
+    free(batch.sites);
+    remove(path);
+}
+
+static void test_hc_page_render(void) {
+    char dir[] = "/tmp/hc-test-XXXXXX";
+    struct test_file files[] = {
+        {"theme/base.html", "{{ root }}:{{ content }}"},       //
+        {"theme/page.html", "{{ title }}={{ content }}"},      //
+        {"content/page.html", "---\ntitle = page\n---\ntext"}, //
+    };
+    test_dir_make(dir, files, ARRAY_LEN(files));
+
+    char tpl_path[PATH_MAX];
+    char in_path[PATH_MAX];
+    snprintf(tpl_path, sizeof(tpl_path), "%s/theme", dir);
+    snprintf(in_path, sizeof(in_path), "%s/content", dir);
+
+    struct hc *hc = hc_alloc(tpl_path);
+    struct hc_site *site = hc_site_alloc(hc, in_path, "/root");
+    assert(site != NULL);
+    assert(hc_page_find(site, "missing.html") == NULL);
+
+    struct hc_page *page = hc_page_find(site, "page.html");
+    assert(page != NULL);
+    assert(hc_page_find(site, "/page.html") == page);
+
+    // too small buffer gets truncated page
+    char buf[8];
+    assert(hc_page_render(site, page, buf, sizeof(buf)) == 15);
+    assert(strcmp(buf, "/root:p") == 0);
+    assert(hc_page_render(site, page, NULL, 0) == 15);
+
+    char full_buf[16];
+    assert(hc_page_render(site, page, full_buf, sizeof(full_buf)) == 15);
+    assert(strcmp(full_buf, "/root:page=text") == 0);
+
+    // shared tree isn't changed by rendering
+    assert(page_content((struct page *)page, NULL) == NULL);
+
+    hc_site_free(site);
+    hc_free(hc);
+
+    remove_at(AT_FDCWD, dir);
+}
+
+static void test_srv_path_decode(void) {
+    char path[PATH_MAX] = "/blog/my%20post.html?x=1#top";
+    assert(srv_path_decode(path));
+    assert(strcmp(path, "/blog/my post.html") == 0);
+
+    strcpy_safe(path, "/a..b/..c", sizeof(path));
+    assert(srv_path_decode(path));
+
+    strcpy_safe(path, "/../etc/passwd", sizeof(path));
+    assert(!srv_path_decode(path));
+    strcpy_safe(path, "/%2e%2e/etc/passwd", sizeof(path));
+    assert(!srv_path_decode(path));
+    strcpy_safe(path, "/a/..", sizeof(path));
+    assert(!srv_path_decode(path));
+    strcpy_safe(path, "/a%00", sizeof(path));
+    assert(!srv_path_decode(path));
+    strcpy_safe(path, "/a%zz", sizeof(path));
+    assert(!srv_path_decode(path));
+    strcpy_safe(path, "a", sizeof(path));
+    assert(!srv_path_decode(path));
+
+    char request[] = "GET / HTTP/1.1\r\naccept-encoding: gzip, br\r\n\r\n";
+    size_t len = 0;
+    char *val = srv_header_find(request, "Accept-Encoding", &len);
+    assert(val != NULL);
+    assert(strncmp(val, "gzip, br", len) == 0 && len == 8);
+    assert(srv_header_find(request, "Host", &len) == NULL);
+}
+
+static void test_srv_cache(void) {
+    struct srv srv = {0};
+    srv.cache_max = 8;
+    pthread_mutex_init(&srv.lock, NULL);
+    pthread_rwlock_init(&srv.tree_lock, NULL);
+
+    struct timespec stamp[] = {{1, 0}, {5, 0}};
+    struct timespec older[] = {{1, 0}, {4, 0}};
+    size_t count = ARRAY_LEN(stamp);
+    srv_cache_put(&srv, "/a", stamp, count, strdup("aaaa"), 4, NULL, 0);
+    srv_cache_put(&srv, "/b", stamp, count, strdup("bbbb"), 4, NULL, 0);
+    assert(srv.cache_size == 8);
+
+    // changed sources invalidate entry, even if mtime moves backwards,
+    // no compressed variant
+    bool is_gzip = true;
+    size_t len = 0;
+    assert(srv_cache_get(&srv, "/a", older, count, &is_gzip, &len) == NULL);
+    assert(srv_cache_get(&srv, "/a", stamp, 1, &is_gzip, &len) == NULL);
+    char *mem = srv_cache_get(&srv, "/a", stamp, count, &is_gzip, &len);
+    assert(mem != NULL && strcmp(mem, "aaaa") == 0 && len == 4);
+    assert(!is_gzip);
+    free(mem);
+
+    // b is least recently used now
+    srv_cache_put(&srv, "/c", stamp, count, strdup("cc"), 2, strdup("z"), 1);
+    assert(srv.cache_size == 7);
+    assert(srv_cache_get(&srv, "/b", stamp, count, &is_gzip, &len) == NULL);
+
+    is_gzip = true;
+    mem = srv_cache_get(&srv, "/c", stamp, count, &is_gzip, &len);
+    assert(mem != NULL && strcmp(mem, "z") == 0 && len == 1 && is_gzip);
+    free(mem);
+
+    // single page bigger than cache is still kept
+    srv_cache_put(&srv, "/b", older, count, strdup("0123456789"), 10, NULL,
+                  0);
+    assert(srv.cache_size == 10);
+    assert(srv.head == srv.tail);
+    mem = srv_cache_get(&srv, "/b", older, count, &is_gzip, &len);
+    assert(mem != NULL && len == 10);
+    free(mem);
+
+    srv_stats_add(&srv, 200, true, 500);
+    srv_stats_add(&srv, 200, false, 100000);
+    srv_stats_add(&srv, 404, false, 10);
+    assert(srv.stats.requests == 3);
+    assert(srv.stats.hits == 1 && srv.stats.misses == 1);
+    assert(srv.stats.not_found == 1);
+    assert(srv.stats.latency_max == 100000);
+    assert(srv.stats.buckets[0] == 2);
+    assert(srv.stats.buckets[ARRAY_LEN(s_srv_buckets)] == 1);
+
+    mem = srv_stats_alloc(&srv, &len);
+    assert(strstr(mem, "hits 1\n") != NULL);
+    free(mem);
+
+    srv_free(&srv);
+}
+
+static void test_cache(void) {
+    char dir[] = "/tmp/hc-test-XXXXXX";
+    struct test_file files[] = {
+        {"index.html", "---\ntitle = root\n---\nroot content"},     //
+        {"blog/post.html", "---\ntitle = post\n---\npost content"}, //
+    };
+    test_dir_make(dir, files, ARRAY_LEN(files));
+
+    char post_path[PATH_MAX];
+    char cache_path[PATH_MAX];
+    snprintf(post_path, sizeof(post_path), "%s/blog/post.html", dir);
+    snprintf(cache_path, sizeof(cache_path), "%s.cache", dir);
+
+    struct page *tree = page_tree_alloc(dir, "", false);
+    cache_write(tree, dir, cache_path);
+    page_free(tree);
+
+    tree = cache_load(cache_path, dir);
+    assert(tree != NULL);
+    page_urls_alloc(tree, "");
+    assert(strcmp(page_conf(tree, "title", NULL), "root") == 0);
+    page_content_load(tree, dir);
+    assert(strcmp(page_content(tree, NULL), "root content") == 0);
+
+    struct page *post = page_find(tree, "/blog/post.html");
+    assert(post != NULL);
+    assert(strcmp(page_conf(post, "title", NULL), "post") == 0);
+    page_content_load(post, dir);
+    assert(strcmp(page_content(post, NULL), "post content") == 0);
+
+    page_free(tree);
+    cache_free();
+
+    // cache is bound to input dir
+    assert(cache_load(cache_path, "other") == NULL);
+
+    // and to source mtimes
+    struct timespec times[2] = {{1, 0}, {1, 0}};
+    utimensat(AT_FDCWD, post_path, times, 0);
+    assert(cache_load(cache_path, dir) == NULL);
+
+    remove(cache_path);
+    remove_at(AT_FDCWD, dir);
+}
+
 int main(void) {
     test_buf();
     test_strcpy_safe();
     test_strcat_safe();
-    test_strsub_alloc();
+    test_scratch();
+    test_strsub_scratch();
+    test_strsub_scratch_filter();
+    test_html_escape_buf();
+    test_md_alloc();
+    test_map();
+    test_frag();
+    test_tpl_render();
+    test_tpl_render_lazy();
+    test_tpl_preload();
 
     test_conf_read();
+    test_conf_alloc();
     test_conf_find();
 
     test_page_alloc();
@@ -1445,8 +8775,27 @@ int main(void) {
     test_page_find();
     test_page_path_append();
     test_page_url_append();
+    test_page_urls_alloc();
+    test_plugin_feed_alloc();
     test_page_find_by_page_path();
 
+    test_page_load();
+    test_tar_header_path();
+    test_search_alloc();
+    test_link_path();
+    test_manifest();
+    test_shard_parse();
+    test_trace();
+    test_check_ph_find();
+    test_pipe_queue();
+    test_batch_read();
+    test_hc_page_render();
+    test_srv_path_decode();
+    test_srv_cache();
+    test_out_publish();
+    test_out_copy_dir();
+    test_cache();
+
     puts("success");
 
     return EXIT_SUCCESS;